@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// 按doc_id直接寻址的得分数组, 用在term-at-a-time的查询中
+// 每个文档除了得分还有一个32位的掩码, 第i位表示查询中的第i个关键字命中了这个文档
+// touched记下被加过分的文档, Reset时只清零这些位置, 所以数组可以在多次查询之间复用, 不用每次都重新分配
+class ScoreAccumulator
+{
+private:
+    std::vector<int> scores;
+    std::vector<uint32_t> masks;
+    std::vector<uint32_t> touched;
+
+public:
+    // 开始一次新的累加, doc_id都小于doc_count
+    void Reset(size_t doc_count)
+    {
+        for (uint32_t doc_id : touched)
+        {
+            scores[doc_id] = 0;
+            masks[doc_id] = 0;
+        }
+        touched.clear();
+        if (scores.size() < doc_count)
+        {
+            scores.resize(doc_count, 0);
+            masks.resize(doc_count, 0);
+        }
+    }
+
+    // 第term个关键字命中了doc_id, 得分加上score
+    void Add(uint32_t doc_id, int score, uint32_t term)
+    {
+        if (masks[doc_id] == 0)
+        {
+            touched.push_back(doc_id);
+        }
+        scores[doc_id] += score;
+        masks[doc_id] |= 1u << term;
+    }
+
+    int Score(uint32_t doc_id) const { return scores[doc_id]; }
+    uint32_t Mask(uint32_t doc_id) const { return masks[doc_id]; }
+
+    // 被加过分的文档, 按第一次加分的顺序
+    const std::vector<uint32_t> &Touched() const { return touched; }
+};
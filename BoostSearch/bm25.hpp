@@ -0,0 +1,85 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "log.hpp"
+#include "conf.hpp"
+
+// BM25F相关性
+// 建立索引时把每个结点的得分算好, 量化成整数impact存进拉链, 查询时只需要把impact加起来
+// tf' = title_weight * title_tf / title_norm + content_weight * content_tf / content_norm
+// field_norm = 1 - field_b + field_b * field_len / avg_field_len
+// score = idf * tf' / (k1 + tf'), idf = ln(1 + (N - df + 0.5) / (df + 0.5))
+// impact = round(score * impact_scale), 至少为1
+const char* const BM25_CONF_PATH = "./conf/bm25.conf";
+
+struct Bm25Params
+{
+    double k1;
+    double title_weight;
+    double content_weight;
+    double title_b;
+    double content_b;
+    double impact_scale;
+
+    Bm25Params()
+        : k1(1.2), title_weight(3), content_weight(1), title_b(0.5), content_b(0.75), impact_scale(10)
+    {}
+
+    // 读取key = value格式的配置文件, 没有出现的参数保持默认值
+    bool Load(const std::string &path)
+    {
+        return ConfReader::Load(path, [this](const std::string &key, const std::string &text) -> bool {
+            double value = atof(text.c_str());
+            if (key == "k1") k1 = value;
+            else if (key == "title_weight") title_weight = value;
+            else if (key == "content_weight") content_weight = value;
+            else if (key == "title_b") title_b = value;
+            else if (key == "content_b") content_b = value;
+            else if (key == "impact_scale") impact_scale = value;
+            else return false;
+            return true;
+            });
+    }
+};
+
+// 用一组文档的统计信息(文档数, 各字段的总词数)计算impact
+class Bm25Scorer
+{
+private:
+    Bm25Params params;
+    double doc_count;
+    double avg_title_len;
+    double avg_content_len;
+
+public:
+    Bm25Scorer(const Bm25Params &params, uint64_t doc_count, uint64_t title_tokens, uint64_t content_tokens)
+        : params(params), doc_count((double)doc_count),
+          avg_title_len(doc_count ? (double)title_tokens / doc_count : 0),
+          avg_content_len(doc_count ? (double)content_tokens / doc_count : 0)
+    {}
+
+    // df: 包含这个关键字的文档数
+    double Idf(uint64_t df) const
+    {
+        return log(1 + (doc_count - df + 0.5) / (df + 0.5));
+    }
+
+    uint32_t Impact(double idf, uint32_t title_tf, uint32_t content_tf, uint32_t title_len, uint32_t content_len) const
+    {
+        double tf = params.title_weight * title_tf / Norm(params.title_b, title_len, avg_title_len)
+                  + params.content_weight * content_tf / Norm(params.content_b, content_len, avg_content_len);
+        double score = idf * tf / (params.k1 + tf);
+        long impact = lround(score * params.impact_scale);
+        return impact < 1 ? 1 : (uint32_t)impact;
+    }
+
+private:
+    static double Norm(double b, uint32_t len, double avg_len)
+    {
+        return avg_len > 0 ? 1 - b + b * len / avg_len : 1;
+    }
+};
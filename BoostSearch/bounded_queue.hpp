@@ -0,0 +1,70 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// 多生产者多消费者的有界阻塞队列, 用来连接流水线中相邻的两个阶段
+// 队列满时Push等待, 下游慢的时候上游自然停下来, 内存占用有上限
+// 生产者都结束之后Close: 消费者取空队列之后Pop返回false
+template <class T>
+class BoundedQueue
+{
+private:
+    std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity(capacity ? capacity : 1), closed(false)
+    {}
+
+    // 队列满时等待; 已经关闭时丢掉item, 返回false
+    bool Push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this]{ return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+        items.push_back(std::move(item));
+        lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    // 队列空时等待; 关闭并且取空之后返回false
+    bool Pop(T *item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_empty.wait(lock, [this]{ return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+        *item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    // 不再接受新的元素, 唤醒所有等待的线程; 已经在队列中的元素还可以取出来
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
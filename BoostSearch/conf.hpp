@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <functional>
+#include <cstdlib>
+#include "log.hpp"
+
+// key = value格式的配置文件, #开头的行是注释, 没有'='的行忽略
+class ConfReader
+{
+public:
+    // 每读到一项调用一次handle(key, value), handle返回false表示不认识这个key
+    static bool Load(const std::string &path, std::function<bool(const std::string &, const std::string &)> handle)
+    {
+        std::ifstream in(path);
+        if (!in.is_open())
+        {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            size_t eq = line.find('=');
+            if (line.empty() || line[0] == '#' || eq == std::string::npos)
+            {
+                continue;
+            }
+            std::string key = Trim(line.substr(0, eq));
+            if (!handle(key, Trim(line.substr(eq + 1))))
+            {
+                logMsg(WARNING, "%s: 未知的参数 %s", path.c_str(), key.c_str());
+            }
+        }
+        return true;
+    }
+
+private:
+    static std::string Trim(const std::string &s)
+    {
+        size_t begin = s.find_first_not_of(" \t\r");
+        size_t end = s.find_last_not_of(" \t\r");
+        return begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+    }
+};
+
+// http_server的配置
+const char* const SERVER_CONF_PATH = "./conf/server.conf";
+
+struct ServerConf
+{
+    size_t query_cache_mb; // 查询结果缓存的内存上限, 0表示不缓存
+    size_t worker_threads; // 处理请求的线程数, 0表示和CPU核数相同
+    size_t max_queue;      // 最多有多少个查询排队, 0表示不限制
+    uint64_t max_queue_cost; // 排队的和正在处理的查询的代价(拉链长度)之和的上限, 0表示不限制
+    int retry_after;       // 拒绝查询时回复的Retry-After(秒)
+    bool watch_input;      // 监视data/input, 有变化的网页直接加入索引
+    int watch_debounce_ms; // 最后一个变化之后等多久才处理这一批
+
+    ServerConf()
+        : query_cache_mb(64), worker_threads(0), max_queue(256), max_queue_cost(4000000), retry_after(1),
+          watch_input(false), watch_debounce_ms(2000)
+    {}
+
+    // 没有出现的参数保持默认值
+    bool Load(const std::string &path)
+    {
+        return ConfReader::Load(path, [this](const std::string &key, const std::string &value) -> bool {
+            if (key == "query_cache_mb") query_cache_mb = strtoul(value.c_str(), nullptr, 10);
+            else if (key == "worker_threads") worker_threads = strtoul(value.c_str(), nullptr, 10);
+            else if (key == "max_queue") max_queue = strtoul(value.c_str(), nullptr, 10);
+            else if (key == "max_queue_cost") max_queue_cost = strtoull(value.c_str(), nullptr, 10);
+            else if (key == "retry_after") retry_after = atoi(value.c_str());
+            else if (key == "watch_input") watch_input = atoi(value.c_str()) != 0;
+            else if (key == "watch_debounce_ms") watch_debounce_ms = atoi(value.c_str());
+            else return false;
+            return true;
+            });
+    }
+};
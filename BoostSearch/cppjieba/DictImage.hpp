@@ -0,0 +1,355 @@
+#ifndef CPPJIEBA_DICT_IMAGE_HPP
+#define CPPJIEBA_DICT_IMAGE_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "limonp/Logging.hpp"
+#include "Trie.hpp"
+
+namespace cppjieba {
+
+using namespace std;
+
+// Everything Jieba reads from its text dictionaries, compiled into one file
+// (Jieba::SaveImage) that is mapped read-only at startup instead of parsed.
+// The trie arrays and the sorted idf table are used in place; units, HMM emit
+// probabilities and stop words are fixed-size records that only need copying.
+// Any layout change must bump DICT_IMAGE_VERSION, older images are rejected.
+const char DICT_IMAGE_MAGIC[8] = {'J', 'B', 'I', 'M', 'A', 'G', 'E', '\0'};
+const uint32_t DICT_IMAGE_VERSION = 1;
+const size_t DICT_IMAGE_MAX_SOURCES = 8;
+const size_t DICT_IMAGE_HMM_STATUS = 4;  // HMMModel::STATUS_SUM
+
+enum DictImageSection {
+  IMAGE_DICT_UNITS,         // ImageUnit[], in DictTrie's static unit order
+  IMAGE_DICT_RUNES,         // Rune[], the words of the units
+  IMAGE_USER_SINGLE_WORDS,  // Rune[], single-rune words from the user dict
+  IMAGE_TRIE_STATES,        // Trie::State[], State::value indexes IMAGE_DICT_UNITS
+  IMAGE_TRIE_CODES,         // uint32_t[Trie::DIRECT_CODES], or empty
+  IMAGE_TRIE_WIDE_CODES,    // ImageRuneCode[]
+  IMAGE_HMM_EMIT,           // ImageEmitProb[]
+  IMAGE_IDF,                // ImageIdf[], sorted by word
+  IMAGE_STOP_WORDS,         // ImageString[]
+  IMAGE_STRINGS,            // chars referred to by ImageString
+  IMAGE_SECTION_NUM
+}; // enum DictImageSection
+
+struct ImageString {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct ImageUnit {
+  double weight;
+  uint32_t word_offset;  // in IMAGE_DICT_RUNES
+  uint32_t word_length;
+  ImageString tag;
+};
+
+struct ImageRuneCode {
+  Rune rune;
+  uint32_t code;
+};
+
+struct ImageEmitProb {
+  double prob;
+  uint32_t status;
+  Rune rune;
+};
+
+struct ImageIdf {
+  double idf;
+  ImageString word;
+};
+
+struct ImageSection {
+  uint64_t offset;
+  uint64_t size;  // bytes
+};
+
+// a text dictionary the image was compiled from, to notice it changed
+struct ImageSource {
+  uint64_t size;
+  int64_t mtime;  // ns
+};
+
+struct DictImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t source_num;
+  uint64_t file_size;
+  ImageSource sources[DICT_IMAGE_MAX_SOURCES];
+
+  // DictTrie
+  double freq_sum;
+  double min_weight;
+  double max_weight;
+  double median_weight;
+  // HMMModel
+  double start_prob[DICT_IMAGE_HMM_STATUS];
+  double trans_prob[DICT_IMAGE_HMM_STATUS][DICT_IMAGE_HMM_STATUS];
+  // KeywordExtractor
+  double idf_average;
+
+  ImageSection sections[IMAGE_SECTION_NUM];
+};
+
+inline bool StatImageSource(const string& path, ImageSource* source) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  source->size = st.st_size;
+  source->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+class DictImageWriter {
+ public:
+  DictImageWriter(): sections_(IMAGE_SECTION_NUM) {
+    memset(&header_, 0, sizeof(header_));
+  }
+
+  DictImageHeader& Header() {
+    return header_;
+  }
+
+  ImageString AddString(const string& s) {
+    ImageString ref;
+    ref.offset = uint32_t(strings_.size());
+    ref.length = uint32_t(s.size());
+    strings_.append(s);
+    return ref;
+  }
+
+  template <class T>
+  void SetSection(DictImageSection id, const T* items, size_t count) {
+    sections_[id].assign((const char*)items, count * sizeof(T));
+  }
+
+  template <class T>
+  void SetSection(DictImageSection id, const vector<T>& items) {
+    SetSection(id, items.empty() ? (const T*)NULL : &items[0], items.size());
+  }
+
+  // writes a temporary file and renames it, a running reader keeps its old mapping
+  bool Save(const string& path, const vector<string>& sources) {
+    XCHECK(sources.size() <= DICT_IMAGE_MAX_SOURCES);
+    memcpy(header_.magic, DICT_IMAGE_MAGIC, sizeof(header_.magic));
+    header_.version = DICT_IMAGE_VERSION;
+    header_.source_num = uint32_t(sources.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+      if (!StatImageSource(sources[i], &header_.sources[i])) {
+        XLOG(ERROR) << "stat " << sources[i] << " failed";
+        return false;
+      }
+    }
+    sections_[IMAGE_STRINGS] = strings_;
+
+    string body;
+    uint64_t offset = sizeof(header_);
+    for (size_t i = 0; i < IMAGE_SECTION_NUM; i++) {
+      while ((offset + body.size()) % 8 != 0) {
+        body.push_back('\0');
+      }
+      header_.sections[i].offset = offset + body.size();
+      header_.sections[i].size = sections_[i].size();
+      body.append(sections_[i]);
+    }
+    header_.file_size = offset + body.size();
+
+    string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (out == NULL) {
+      XLOG(ERROR) << "open " << tmp << " failed";
+      return false;
+    }
+    bool ok = fwrite(&header_, sizeof(header_), 1, out) == 1
+      && fwrite(body.data(), 1, body.size(), out) == body.size();
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+      XLOG(ERROR) << "write " << path << " failed";
+      unlink(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  DictImageHeader header_;
+  vector<string> sections_;
+  string strings_;
+}; // class DictImageWriter
+
+// A mapped image. Objects loaded from it may point into the mapping, so it
+// must stay open as long as they are used.
+class DictImage {
+ public:
+  DictImage(): addr_(NULL), length_(0) {
+  }
+  ~DictImage() {
+    Close();
+  }
+
+  // false if the file is missing (quietly), from another version, or corrupted
+  bool Open(const string& path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      if (errno != ENOENT) {
+        XLOG(ERROR) << "open " << path << " failed: " << strerror(errno);
+      }
+      return false;
+    }
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) {
+      XLOG(ERROR) << "mmap " << path << " failed";
+      return false;
+    }
+    addr_ = (const char*)p;
+    length_ = st.st_size;
+    if (!Check()) {
+      XLOG(ERROR) << path << " is not a dict image of version " << DICT_IMAGE_VERSION << ", or is corrupted";
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    if (addr_ != NULL) {
+      munmap((void*)addr_, length_);
+      addr_ = NULL;
+      length_ = 0;
+    }
+  }
+
+  // true if one of the text dictionaries changed since the image was compiled;
+  // missing ones are not compared, the image can be deployed without them
+  bool Stale(const vector<string>& sources) const {
+    const DictImageHeader& header = Header();
+    if (sources.size() != header.source_num) {
+      return true;
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+      ImageSource now;
+      if (StatImageSource(sources[i], &now)
+            && (now.size != header.sources[i].size || now.mtime != header.sources[i].mtime)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const DictImageHeader& Header() const {
+    return *(const DictImageHeader*)addr_;
+  }
+
+  template <class T>
+  const T* Section(DictImageSection id, size_t* count) const {
+    const ImageSection& section = Header().sections[id];
+    *count = section.size / sizeof(T);
+    return (const T*)(addr_ + section.offset);
+  }
+
+  const char* StringData(ImageString s) const {
+    return addr_ + Header().sections[IMAGE_STRINGS].offset + s.offset;
+  }
+
+  string String(ImageString s) const {
+    return string(StringData(s), s.length);
+  }
+
+ private:
+  // everything a loader follows must stay inside the file
+  bool Check() const {
+    if (length_ < sizeof(DictImageHeader)) {
+      return false;
+    }
+    const DictImageHeader& header = Header();
+    if (memcmp(header.magic, DICT_IMAGE_MAGIC, sizeof(header.magic)) != 0
+          || header.version != DICT_IMAGE_VERSION
+          || header.file_size != length_
+          || header.source_num > DICT_IMAGE_MAX_SOURCES) {
+      return false;
+    }
+    static const size_t item_sizes[IMAGE_SECTION_NUM] = {
+      sizeof(ImageUnit), sizeof(Rune), sizeof(Rune), sizeof(Trie::State), sizeof(uint32_t),
+      sizeof(ImageRuneCode), sizeof(ImageEmitProb), sizeof(ImageIdf), sizeof(ImageString), 1
+    };
+    for (size_t i = 0; i < IMAGE_SECTION_NUM; i++) {
+      const ImageSection& section = header.sections[i];
+      if (section.offset % 8 != 0 || section.offset > length_ || section.size > length_ - section.offset
+            || section.size % item_sizes[i] != 0) {
+        return false;
+      }
+    }
+
+    size_t unit_num, rune_num, state_num, code_num, emit_num, idf_num, stop_num;
+    const ImageUnit* units = Section<ImageUnit>(IMAGE_DICT_UNITS, &unit_num);
+    Section<Rune>(IMAGE_DICT_RUNES, &rune_num);
+    const Trie::State* states = Section<Trie::State>(IMAGE_TRIE_STATES, &state_num);
+    Section<uint32_t>(IMAGE_TRIE_CODES, &code_num);
+    const ImageEmitProb* emits = Section<ImageEmitProb>(IMAGE_HMM_EMIT, &emit_num);
+    const ImageIdf* idfs = Section<ImageIdf>(IMAGE_IDF, &idf_num);
+    const ImageString* stops = Section<ImageString>(IMAGE_STOP_WORDS, &stop_num);
+    if (state_num == 0 || (code_num != 0 && code_num != Trie::DIRECT_CODES)) {
+      return false;
+    }
+    for (size_t i = 0; i < unit_num; i++) {
+      if (units[i].word_offset > rune_num || units[i].word_length > rune_num - units[i].word_offset
+            || !StringInRange(units[i].tag)) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < state_num; i++) {
+      if (states[i].value >= 0 && size_t(states[i].value) >= unit_num) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < emit_num; i++) {
+      if (emits[i].status >= DICT_IMAGE_HMM_STATUS) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < idf_num; i++) {
+      if (!StringInRange(idfs[i].word)) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < stop_num; i++) {
+      if (!StringInRange(stops[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool StringInRange(ImageString s) const {
+    uint64_t size = Header().sections[IMAGE_STRINGS].size;
+    return s.offset <= size && s.length <= size - s.offset;
+  }
+
+  const char* addr_;
+  size_t length_;
+
+  DictImage(const DictImage&);
+  DictImage& operator=(const DictImage&);
+}; // class DictImage
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_DICT_IMAGE_HPP
@@ -14,6 +14,7 @@
 #include "limonp/Logging.hpp"
 #include "Unicode.hpp"
 #include "Trie.hpp"
+#include "DictImage.hpp"
 
 namespace cppjieba {
 
@@ -36,10 +37,58 @@ class DictTrie {
     Init(dict_path, user_dict_paths, user_word_weight_opt);
   }
 
+  // the trie arrays stay in the image, which must outlive this DictTrie
+  explicit DictTrie(const DictImage& image, UserWordWeightOption user_word_weight_opt = WordWeightMedian) {
+    Init(image, user_word_weight_opt);
+  }
+
   ~DictTrie() {
     delete trie_;
   }
 
+  // only the words and weights as loaded; words inserted afterwards are not saved
+  void SaveImage(DictImageWriter* writer) const {
+    XCHECK(active_node_infos_.empty() && trie_->Values().size() == static_node_infos_.size())
+      << "words were inserted after loading";
+    vector<ImageUnit> units(static_node_infos_.size());
+    vector<Rune> runes;
+    for (size_t i = 0; i < static_node_infos_.size(); i++) {
+      const DictUnit& node_info = static_node_infos_[i];
+      XCHECK(trie_->Values()[i] == &node_info);
+      units[i].weight = node_info.weight;
+      units[i].word_offset = uint32_t(runes.size());
+      units[i].word_length = uint32_t(node_info.word.size());
+      runes.insert(runes.end(), node_info.word.begin(), node_info.word.end());
+      units[i].tag = writer->AddString(node_info.tag);
+    }
+    writer->SetSection(IMAGE_DICT_UNITS, units);
+    writer->SetSection(IMAGE_DICT_RUNES, runes);
+
+    vector<Rune> single_words(user_dict_single_chinese_word_.begin(), user_dict_single_chinese_word_.end());
+    sort(single_words.begin(), single_words.end());
+    writer->SetSection(IMAGE_USER_SINGLE_WORDS, single_words);
+
+    writer->SetSection(IMAGE_TRIE_STATES, trie_->States(), trie_->StateNum());
+    if (trie_->Codes() != NULL) {
+      writer->SetSection(IMAGE_TRIE_CODES, trie_->Codes(), Trie::DIRECT_CODES);
+    }
+    vector<ImageRuneCode> wide_codes;
+    for (unordered_map<Rune, uint32_t>::const_iterator it = trie_->WideCodes().begin(); it != trie_->WideCodes().end(); ++it) {
+      ImageRuneCode code;
+      code.rune = it->first;
+      code.code = it->second;
+      wide_codes.push_back(code);
+    }
+    sort(wide_codes.begin(), wide_codes.end(), RuneCodeLess);
+    writer->SetSection(IMAGE_TRIE_WIDE_CODES, wide_codes);
+
+    DictImageHeader& header = writer->Header();
+    header.freq_sum = freq_sum_;
+    header.min_weight = min_weight_;
+    header.max_weight = max_weight_;
+    header.median_weight = median_weight_;
+  }
+
   bool InsertUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
     DictUnit node_info;
     if (!MakeNodeInfo(node_info, word, user_word_default_weight_, tag)) {
@@ -170,6 +219,48 @@ class DictTrie {
     CreateTrie(static_node_infos_);
   }
   
+  void Init(const DictImage& image, UserWordWeightOption user_word_weight_opt) {
+    size_t unit_num, rune_num;
+    const ImageUnit* units = image.Section<ImageUnit>(IMAGE_DICT_UNITS, &unit_num);
+    const Rune* runes = image.Section<Rune>(IMAGE_DICT_RUNES, &rune_num);
+    static_node_infos_.resize(unit_num);
+    vector<const DictUnit*> valuePointers(unit_num);
+    for (size_t i = 0; i < unit_num; i++) {
+      DictUnit& node_info = static_node_infos_[i];
+      for (size_t j = 0; j < units[i].word_length; j++) {
+        node_info.word.push_back(runes[units[i].word_offset + j]);
+      }
+      node_info.weight = units[i].weight;
+      node_info.tag = image.String(units[i].tag);
+      valuePointers[i] = &node_info;
+    }
+
+    size_t single_num;
+    const Rune* single_words = image.Section<Rune>(IMAGE_USER_SINGLE_WORDS, &single_num);
+    user_dict_single_chinese_word_.insert(single_words, single_words + single_num);
+
+    const DictImageHeader& header = image.Header();
+    freq_sum_ = header.freq_sum;
+    min_weight_ = header.min_weight;
+    max_weight_ = header.max_weight;
+    median_weight_ = header.median_weight;
+    SetUserWordWeight(user_word_weight_opt);
+
+    size_t state_num, code_num, wide_num;
+    const Trie::State* states = image.Section<Trie::State>(IMAGE_TRIE_STATES, &state_num);
+    const uint32_t* codes = image.Section<uint32_t>(IMAGE_TRIE_CODES, &code_num);
+    const ImageRuneCode* wide = image.Section<ImageRuneCode>(IMAGE_TRIE_WIDE_CODES, &wide_num);
+    vector<pair<Rune, uint32_t> > wide_codes;
+    for (size_t i = 0; i < wide_num; i++) {
+      wide_codes.push_back(make_pair(wide[i].rune, wide[i].code));
+    }
+    trie_ = new Trie(states, state_num, code_num ? codes : NULL, wide_codes, valuePointers);
+  }
+
+  static bool RuneCodeLess(const ImageRuneCode& lhs, const ImageRuneCode& rhs) {
+    return lhs.rune < rhs.rune;
+  }
+
   void CreateTrie(const vector<DictUnit>& dictUnits) {
     assert(dictUnits.size());
     vector<Unicode> words;
@@ -227,6 +318,10 @@ class DictTrie {
     min_weight_ = x[0].weight;
     max_weight_ = x[x.size() - 1].weight;
     median_weight_ = x[x.size() / 2].weight;
+    SetUserWordWeight(option);
+  }
+
+  void SetUserWordWeight(UserWordWeightOption option) {
     switch (option) {
      case WordWeightMin:
        user_word_default_weight_ = min_weight_;
@@ -3,6 +3,7 @@
 
 #include "limonp/StringUtil.hpp"
 #include "Trie.hpp"
+#include "DictImage.hpp"
 
 namespace cppjieba {
 
@@ -17,6 +18,16 @@ struct HMMModel {
   enum {B = 0, E = 1, M = 2, S = 3, STATUS_SUM = 4};
 
   HMMModel(const string& modelPath) {
+    Init();
+    LoadModel(modelPath);
+  }
+  explicit HMMModel(const DictImage& image) {
+    Init();
+    LoadImage(image);
+  }
+  ~HMMModel() {
+  }
+  void Init() {
     memset(startProb, 0, sizeof(startProb));
     memset(transProb, 0, sizeof(transProb));
     statMap[0] = 'B';
@@ -27,9 +38,41 @@ struct HMMModel {
     emitProbVec.push_back(&emitProbE);
     emitProbVec.push_back(&emitProbM);
     emitProbVec.push_back(&emitProbS);
-    LoadModel(modelPath);
   }
-  ~HMMModel() {
+  void LoadImage(const DictImage& image) {
+    const DictImageHeader& header = image.Header();
+    memcpy(startProb, header.start_prob, sizeof(startProb));
+    memcpy(transProb, header.trans_prob, sizeof(transProb));
+    size_t n;
+    const ImageEmitProb* emits = image.Section<ImageEmitProb>(IMAGE_HMM_EMIT, &n);
+    for (size_t i = 0; i < STATUS_SUM; i++) {
+      emitProbVec[i]->reserve(n / STATUS_SUM);
+    }
+    for (size_t i = 0; i < n; i++) {
+      (*emitProbVec[emits[i].status])[emits[i].rune] = emits[i].prob;
+    }
+  }
+  // emit probabilities sorted by status and rune, so the image only depends on the model
+  void SaveImage(DictImageWriter* writer) const {
+    DictImageHeader& header = writer->Header();
+    memcpy(header.start_prob, startProb, sizeof(startProb));
+    memcpy(header.trans_prob, transProb, sizeof(transProb));
+    vector<ImageEmitProb> emits;
+    for (size_t i = 0; i < STATUS_SUM; i++) {
+      size_t first = emits.size();
+      for (EmitProbMap::const_iterator it = emitProbVec[i]->begin(); it != emitProbVec[i]->end(); ++it) {
+        ImageEmitProb emit;
+        emit.prob = it->second;
+        emit.status = uint32_t(i);
+        emit.rune = it->first;
+        emits.push_back(emit);
+      }
+      sort(emits.begin() + first, emits.end(), EmitLess);
+    }
+    writer->SetSection(IMAGE_HMM_EMIT, emits);
+  }
+  static bool EmitLess(const ImageEmitProb& lhs, const ImageEmitProb& rhs) {
+    return lhs.rune < rhs.rune;
   }
   void LoadModel(const string& filePath) {
     ifstream ifile(filePath.c_str());
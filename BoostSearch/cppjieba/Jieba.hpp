@@ -22,9 +22,30 @@ class Jieba {
       query_seg_(&dict_trie_, &model_),
       extractor(&dict_trie_, &model_, idfPath, stopWordPath) {
   }
+  // loads from an image written by SaveImage; the image must outlive this Jieba
+  explicit Jieba(const DictImage& image)
+    : dict_trie_(image),
+      model_(image),
+      mp_seg_(&dict_trie_),
+      hmm_seg_(&model_),
+      mix_seg_(&dict_trie_, &model_),
+      full_seg_(&dict_trie_),
+      query_seg_(&dict_trie_, &model_),
+      extractor(&dict_trie_, &model_, image) {
+  }
   ~Jieba() {
   }
 
+  // compiles the loaded dictionaries into path; sources are the text files
+  // they came from, recorded so a loader can tell the image is out of date
+  bool SaveImage(const string& path, const vector<string>& sources) const {
+    DictImageWriter writer;
+    dict_trie_.SaveImage(&writer);
+    model_.SaveImage(&writer);
+    extractor.SaveImage(&writer);
+    return writer.Save(path, sources);
+  }
+
   struct LocWord {
     string word;
     size_t begin;
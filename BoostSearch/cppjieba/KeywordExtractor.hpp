@@ -24,7 +24,7 @@ class KeywordExtractor {
         const string& idfPath, 
         const string& stopWordPath, 
         const string& userDict = "") 
-    : segment_(dictPath, hmmFilePath, userDict) {
+    : segment_(dictPath, hmmFilePath, userDict), image_(NULL), image_idfs_(NULL), image_idf_num_(0) {
     LoadIdfDict(idfPath);
     LoadStopWordDict(stopWordPath);
   }
@@ -32,13 +32,43 @@ class KeywordExtractor {
         const HMMModel* model,
         const string& idfPath, 
         const string& stopWordPath) 
-    : segment_(dictTrie, model) {
+    : segment_(dictTrie, model), image_(NULL), image_idfs_(NULL), image_idf_num_(0) {
     LoadIdfDict(idfPath);
     LoadStopWordDict(stopWordPath);
   }
+  KeywordExtractor(const DictTrie* dictTrie, 
+        const HMMModel* model,
+        const DictImage& image) 
+    : segment_(dictTrie, model), image_(NULL), image_idfs_(NULL), image_idf_num_(0) {
+    LoadImage(image);
+  }
   ~KeywordExtractor() {
   }
 
+  // idf and stop words sorted, so the image only depends on the dictionaries
+  void SaveImage(DictImageWriter* writer) const {
+    vector<pair<string, double> > entries(idfMap_.begin(), idfMap_.end());
+    for (size_t i = 0; i < image_idf_num_; i++) {
+      entries.push_back(make_pair(image_->String(image_idfs_[i].word), image_idfs_[i].idf));
+    }
+    sort(entries.begin(), entries.end());
+    vector<ImageIdf> idfs(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+      idfs[i].idf = entries[i].second;
+      idfs[i].word = writer->AddString(entries[i].first);
+    }
+    writer->SetSection(IMAGE_IDF, idfs);
+    writer->Header().idf_average = idfAverage_;
+
+    vector<string> words(stopWords_.begin(), stopWords_.end());
+    sort(words.begin(), words.end());
+    vector<ImageString> stops(words.size());
+    for (size_t i = 0; i < words.size(); i++) {
+      stops[i] = writer->AddString(words[i]);
+    }
+    writer->SetSection(IMAGE_STOP_WORDS, stops);
+  }
+
   void Extract(const string& sentence, vector<string>& keywords, size_t topN) const {
     vector<Word> topWords;
     Extract(sentence, topWords, topN);
@@ -78,12 +108,7 @@ class KeywordExtractor {
     keywords.clear();
     keywords.reserve(wordmap.size());
     for (map<string, Word>::iterator itr = wordmap.begin(); itr != wordmap.end(); ++itr) {
-      unordered_map<string, double>::const_iterator cit = idfMap_.find(itr->first);
-      if (cit != idfMap_.end()) {
-        itr->second.weight *= cit->second;
-      } else {
-        itr->second.weight *= idfAverage_;
-      }
+      itr->second.weight *= GetIdf(itr->first);
       itr->second.word = itr->first;
       keywords.push_back(itr->second);
     }
@@ -121,6 +146,42 @@ class KeywordExtractor {
     idfAverage_ = idfSum / lineno;
     assert(idfAverage_ > 0.0);
   }
+  double GetIdf(const string& word) const {
+    if (image_ != NULL) {
+      const ImageIdf* it = lower_bound(image_idfs_, image_idfs_ + image_idf_num_, word, ImageIdfLess(image_));
+      if (it != image_idfs_ + image_idf_num_ && image_->String(it->word) == word) {
+        return it->idf;
+      }
+      return idfAverage_;
+    }
+    unordered_map<string, double>::const_iterator cit = idfMap_.find(word);
+    return cit != idfMap_.end() ? cit->second : idfAverage_;
+  }
+
+  struct ImageIdfLess {
+    const DictImage* image;
+    explicit ImageIdfLess(const DictImage* i): image(i) {
+    }
+    bool operator()(const ImageIdf& lhs, const string& rhs) const {
+      ImageString s = lhs.word;
+      int cmp = memcmp(image->StringData(s), rhs.data(), min<size_t>(s.length, rhs.size()));
+      return cmp < 0 || (cmp == 0 && s.length < rhs.size());
+    }
+  };
+
+  // idf is looked up in the sorted table inside the image, only the few stop words are copied
+  void LoadImage(const DictImage& image) {
+    size_t n;
+    image_ = &image;
+    image_idfs_ = image.Section<ImageIdf>(IMAGE_IDF, &image_idf_num_);
+    idfAverage_ = image.Header().idf_average;
+
+    const ImageString* stops = image.Section<ImageString>(IMAGE_STOP_WORDS, &n);
+    stopWords_.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      stopWords_.insert(image.String(stops[i]));
+    }
+  }
   void LoadStopWordDict(const string& filePath) {
     ifstream ifs(filePath.c_str());
     XCHECK(ifs.is_open()) << "open " << filePath << " failed";
@@ -137,6 +198,9 @@ class KeywordExtractor {
 
   MixSegment segment_;
   unordered_map<string, double> idfMap_;
+  const DictImage* image_;        // idf is in the image instead of idfMap_ when loaded from one
+  const ImageIdf* image_idfs_;
+  size_t image_idf_num_;
   double idfAverage_;
 
   unordered_set<string> stopWords_;
@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
 #include "limonp/StdExtension.hpp"
 #include "Unicode.hpp"
 
@@ -38,24 +41,44 @@ struct Dag {
 
 typedef Rune TrieKey;
 
-class TrieNode {
- public :
-  TrieNode(): next(NULL), ptValue(NULL) {
-  }
- public:
-  typedef unordered_map<TrieKey, TrieNode*> NextMap;
-  NextMap *next;
-  const DictUnit *ptValue;
-};
-
+// Double-array trie: state t is a child of state s on code c iff
+// states_[t].check == s and t == states_[s].base + c.
+// Runes are first mapped to dense codes (1..code_num_, 0 = not in the dict),
+// most frequent first, so the arrays stay small and a transition costs
+// two array reads instead of a hash lookup and a pointer chase.
+// The arrays are plain PODs, so a built trie can be saved and later used in
+// place from a mapped file (see DictImage.hpp).
 class Trie {
  public:
+  struct State {
+    int32_t base;   // 0: no children yet
+    int32_t check;  // parent state, FREE if unused
+    int32_t value;  // index into values_, -1 if no word ends here
+  };
+
+  static const Rune DIRECT_CODES = 0x10000; // runes below this use codes_, the rest wide_codes_
+
   Trie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers)
-   : root_(new TrieNode) {
+   : states_(NULL), state_num_(0), codes_(NULL), code_num_(0), next_check_pos_(CHECK_POS_CLASSES, 1) {
     CreateTrie(keys, valuePointers);
   }
+
+  // Wraps arrays saved from another trie without copying them; they must
+  // outlive this trie. codes is NULL or has DIRECT_CODES entries,
+  // valuePointers[i] is the word of State::value i.
+  Trie(const State* states, size_t state_num, const uint32_t* codes,
+        const vector<pair<Rune, uint32_t> >& wide_codes, const vector<const DictUnit*>& valuePointers)
+   : states_(states), state_num_(state_num), codes_(codes), code_num_(0), values_(valuePointers),
+     next_check_pos_(CHECK_POS_CLASSES, 1) {
+    for (size_t i = 0; codes_ != NULL && i < DIRECT_CODES; i++) {
+      code_num_ = max(code_num_, codes_[i]);
+    }
+    for (size_t i = 0; i < wide_codes.size(); i++) {
+      wide_codes_[wide_codes[i].first] = wide_codes[i].second;
+      code_num_ = max(code_num_, wide_codes[i].second);
+    }
+  }
   ~Trie() {
-    DeleteNode(root_);
   }
 
   const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
@@ -63,111 +86,363 @@ class Trie {
       return NULL;
     }
 
-    const TrieNode* ptNode = root_;
-    TrieNode::NextMap::const_iterator citer;
+    int32_t state = ROOT;
     for (RuneStrArray::const_iterator it = begin; it != end; it++) {
-      if (NULL == ptNode->next) {
-        return NULL;
-      }
-      citer = ptNode->next->find(it->rune);
-      if (ptNode->next->end() == citer) {
+      state = Next(state, it->rune);
+      if (state < 0) {
         return NULL;
       }
-      ptNode = citer->second;
     }
-    return ptNode->ptValue;
+    return Value(state);
   }
 
   void Find(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<struct Dag>&res, 
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    assert(root_ != NULL);
     res.resize(end - begin);
 
-    const TrieNode *ptNode = NULL;
-    TrieNode::NextMap::const_iterator citer;
     for (size_t i = 0; i < size_t(end - begin); i++) {
       res[i].runestr = *(begin + i);
 
-      if (root_->next != NULL && root_->next->end() != (citer = root_->next->find(res[i].runestr.rune))) {
-        ptNode = citer->second;
-      } else {
-        ptNode = NULL;
-      }
-      if (ptNode != NULL) {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, ptNode->ptValue));
-      } else {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, static_cast<const DictUnit*>(NULL)));
-      }
+      int32_t state = Next(ROOT, res[i].runestr.rune);
+      res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, state < 0 ? NULL : Value(state)));
 
-      for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
-        if (ptNode == NULL || ptNode->next == NULL) {
-          break;
-        }
-        citer = ptNode->next->find((begin + j)->rune);
-        if (ptNode->next->end() == citer) {
+      for (size_t j = i + 1; state >= 0 && j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
+        state = Next(state, (begin + j)->rune);
+        if (state < 0) {
           break;
         }
-        ptNode = citer->second;
-        if (NULL != ptNode->ptValue) {
-          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, ptNode->ptValue));
+        if (states_[state].value >= 0) {
+          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, values_[states_[state].value]));
         }
       }
     }
   }
 
+  // Inserting after construction (user words at runtime) may relocate the
+  // children of one state per rune; slower than the batch build but rare.
+  // A trie wrapping saved arrays copies them first.
   void InsertNode(const Unicode& key, const DictUnit* ptValue) {
     if (key.begin() == key.end()) {
       return;
     }
 
-    TrieNode::NextMap::const_iterator kmIter;
-    TrieNode *ptNode = root_;
+    Detach();
+    int32_t state = ROOT;
     for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
-      if (NULL == ptNode->next) {
-        ptNode->next = new TrieNode::NextMap;
-      }
-      kmIter = ptNode->next->find(*citer);
-      if (ptNode->next->end() == kmIter) {
-        TrieNode *nextNode = new TrieNode;
-
-        ptNode->next->insert(make_pair(*citer, nextNode));
-        ptNode = nextNode;
-      } else {
-        ptNode = kmIter->second;
+      uint32_t code = Code(*citer);
+      if (code == 0) {
+        code = AddCode(*citer);
       }
+      int32_t next = Child(state, code);
+      state = next >= 0 ? next : AddChild(state, code);
     }
-    assert(ptNode != NULL);
-    ptNode->ptValue = ptValue;
+    values_.push_back(ptValue);
+    owned_states_[state].value = int32_t(values_.size() - 1);
+  }
+
+  // for saving the trie
+  const State* States() const {
+    return states_;
+  }
+  size_t StateNum() const {
+    return state_num_;
+  }
+  const uint32_t* Codes() const {
+    return codes_;
+  }
+  const unordered_map<Rune, uint32_t>& WideCodes() const {
+    return wide_codes_;
+  }
+  const vector<const DictUnit*>& Values() const {
+    return values_;
   }
 
  private:
+  static const int32_t ROOT = 0;
+  static const int32_t FREE = -1;
+  static const size_t CHECK_POS_CLASSES = 16;
+  static const size_t MAX_BASE_TRIES = 32;
+
   void CreateTrie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers) {
+    Reserve(1);
+    owned_states_[ROOT].check = ROOT;
     if (valuePointers.empty() || keys.empty()) {
       return;
     }
     assert(keys.size() == valuePointers.size());
+    values_ = valuePointers;
+
+    AssignCodes(keys);
 
+    // sorted by key, a later duplicate wins like repeated InsertNode would
+    vector<size_t> order;
+    order.reserve(keys.size());
     for (size_t i = 0; i < keys.size(); i++) {
-      InsertNode(keys[i], valuePointers[i]);
+      if (!keys[i].empty()) {
+        order.push_back(i);
+      }
+    }
+    stable_sort(order.begin(), order.end(), KeyLess(keys));
+    vector<size_t> sorted;
+    sorted.reserve(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      if (!sorted.empty() && SameKey(keys[sorted.back()], keys[order[i]])) {
+        sorted.back() = order[i];
+      } else {
+        sorted.push_back(order[i]);
+      }
+    }
+
+    Build(keys, sorted, 0, sorted.size(), 0, ROOT);
+
+    size_t used = owned_states_.size();
+    while (used > 1 && owned_states_[used - 1].check == FREE) {
+      used--;
+    }
+    vector<State>(owned_states_.begin(), owned_states_.begin() + used).swap(owned_states_);
+    Sync();
+  }
+
+  struct KeyLess {
+    const vector<Unicode>& keys;
+    explicit KeyLess(const vector<Unicode>& k): keys(k) {
+    }
+    bool operator()(size_t a, size_t b) const {
+      return lexicographical_compare(keys[a].begin(), keys[a].end(), keys[b].begin(), keys[b].end());
+    }
+  };
+
+  static bool SameKey(const Unicode& a, const Unicode& b) {
+    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin());
+  }
+
+  // codes ordered by how many keys use the rune: frequent runes get small codes
+  void AssignCodes(const vector<Unicode>& keys) {
+    unordered_map<Rune, size_t> freq;
+    for (size_t i = 0; i < keys.size(); i++) {
+      for (size_t j = 0; j < keys[i].size(); j++) {
+        freq[keys[i][j]]++;
+      }
+    }
+    vector<pair<size_t, Rune> > runes;
+    runes.reserve(freq.size());
+    for (unordered_map<Rune, size_t>::const_iterator it = freq.begin(); it != freq.end(); ++it) {
+      runes.push_back(make_pair(it->second, it->first));
+    }
+    sort(runes.begin(), runes.end(), greater<pair<size_t, Rune> >());
+    for (size_t i = 0; i < runes.size(); i++) {
+      AddCode(runes[i].second);
+    }
+  }
+
+  uint32_t AddCode(Rune rune) {
+    uint32_t code = ++code_num_;
+    if (rune < DIRECT_CODES) {
+      if (owned_codes_.empty()) {
+        owned_codes_.resize(DIRECT_CODES, 0);
+        Sync();
+      }
+      owned_codes_[rune] = code;
+    } else {
+      wide_codes_[rune] = code;
     }
+    return code;
   }
 
-  void DeleteNode(TrieNode* node) {
-    if (NULL == node) {
+  uint32_t Code(Rune rune) const {
+    if (rune < DIRECT_CODES) {
+      return codes_ == NULL ? 0 : codes_[rune];
+    }
+    unordered_map<Rune, uint32_t>::const_iterator it = wide_codes_.find(rune);
+    return it == wide_codes_.end() ? 0 : it->second;
+  }
+
+  int32_t Child(int32_t state, uint32_t code) const {
+    int32_t base = states_[state].base;
+    if (base == 0 || code == 0) {
+      return -1;
+    }
+    size_t next = size_t(base) + code;
+    if (next >= state_num_ || states_[next].check != state) {
+      return -1;
+    }
+    return int32_t(next);
+  }
+
+  int32_t Next(int32_t state, Rune rune) const {
+    return Child(state, Code(rune));
+  }
+
+  const DictUnit* Value(int32_t state) const {
+    return states_[state].value < 0 ? NULL : values_[states_[state].value];
+  }
+
+  // point the read-only views at the owned arrays after they change
+  void Sync() {
+    states_ = owned_states_.empty() ? NULL : &owned_states_[0];
+    state_num_ = owned_states_.size();
+    codes_ = owned_codes_.empty() ? NULL : &owned_codes_[0];
+  }
+
+  // take a private copy of saved arrays before modifying them
+  void Detach() {
+    if (owned_states_.empty()) {
+      owned_states_.assign(states_, states_ + state_num_);
+    }
+    if (owned_codes_.empty() && codes_ != NULL) {
+      owned_codes_.assign(codes_, codes_ + DIRECT_CODES);
+    }
+    Sync();
+  }
+
+  // keys[sorted[lo, hi)] share their first depth runes, which lead to state
+  void Build(const vector<Unicode>& keys, const vector<size_t>& sorted,
+        size_t lo, size_t hi, size_t depth, int32_t state) {
+    if (lo < hi && keys[sorted[lo]].size() == depth) {
+      owned_states_[state].value = int32_t(sorted[lo]);
+      lo++;
+    }
+    if (lo == hi) {
+      return;
+    }
+
+    vector<pair<uint32_t, size_t> > children; // (code, first key), keys are grouped by rune
+    for (size_t i = lo; i < hi; i++) {
+      Rune rune = keys[sorted[i]][depth];
+      if (i == lo || rune != keys[sorted[i - 1]][depth]) {
+        children.push_back(make_pair(Code(rune), i));
+      }
+    }
+    vector<uint32_t> codes(children.size());
+    for (size_t i = 0; i < children.size(); i++) {
+      codes[i] = children[i].first;
+    }
+    sort(codes.begin(), codes.end());
+
+    int32_t base = FindBase(codes);
+    owned_states_[state].base = base;
+    for (size_t i = 0; i < codes.size(); i++) {
+      owned_states_[base + codes[i]].check = state;
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+      size_t end = i + 1 < children.size() ? children[i + 1].second : hi;
+      Build(keys, sorted, children[i].second, end, depth + 1, base + children[i].first);
+    }
+  }
+
+  // a base >= 1 with every base + codes[i] free; codes sorted ascending.
+  // The scan for a state with n children starts at next_check_pos_[log2(n)]:
+  // everything before it was either occupied or too crowded for a state that size.
+  int32_t FindBase(const vector<uint32_t>& codes) {
+    assert(!codes.empty());
+    size_t cls = 0;
+    while (cls + 1 < CHECK_POS_CLASSES && (size_t(1) << (cls + 1)) <= codes.size()) {
+      cls++;
+    }
+    size_t& start = next_check_pos_[cls];
+    size_t pos = max(size_t(codes[0]) + 1, start);
+    size_t tried = 0;
+    bool first = true;
+    for (;; pos++) {
+      Reserve(pos + 1);
+      if (owned_states_[pos].check != FREE) {
+        continue;
+      }
+      if (first) {
+        start = pos;
+        first = false;
+      }
+      size_t base = pos - codes[0];
+      Reserve(base + codes.back() + 1);
+      size_t i = 1;
+      while (i < codes.size() && owned_states_[base + codes[i]].check == FREE) {
+        i++;
+      }
+      if (i == codes.size()) {
+        // the gaps before pos are too crowded for this size: skip them next time
+        if (tried > MAX_BASE_TRIES) {
+          start = pos;
+        }
+        return int32_t(base);
+      }
+      tried++;
+    }
+  }
+
+  void Reserve(size_t size) {
+    if (size <= owned_states_.size()) {
       return;
     }
-    if (NULL != node->next) {
-      for (TrieNode::NextMap::iterator it = node->next->begin(); it != node->next->end(); ++it) {
-        DeleteNode(it->second);
+    State unused;
+    unused.base = 0;
+    unused.check = FREE;
+    unused.value = -1;
+    owned_states_.resize(max(size, owned_states_.size() * 2), unused);
+    Sync();
+  }
+
+  // add a child on code to state, moving its existing children elsewhere when the slot is taken
+  int32_t AddChild(int32_t state, uint32_t code) {
+    int32_t base = owned_states_[state].base;
+    if (base != 0) {
+      Reserve(size_t(base) + code + 1);
+      if (owned_states_[base + code].check == FREE) {
+        owned_states_[base + code].check = state;
+        return base + code;
+      }
+    }
+
+    vector<uint32_t> codes = ChildCodes(state);
+    codes.push_back(code);
+    sort(codes.begin(), codes.end());
+    int32_t new_base = FindBase(codes);
+    for (size_t i = 0; i < codes.size(); i++) {
+      if (codes[i] == code) {
+        continue;
+      }
+      int32_t from = base + codes[i];
+      int32_t to = new_base + codes[i];
+      vector<uint32_t> grandchildren = ChildCodes(from);
+      owned_states_[to] = owned_states_[from];
+      for (size_t j = 0; j < grandchildren.size(); j++) {
+        owned_states_[owned_states_[from].base + grandchildren[j]].check = to;
       }
-      delete node->next;
+      owned_states_[from].base = 0;
+      owned_states_[from].check = FREE;
+      owned_states_[from].value = -1;
     }
-    delete node;
+    owned_states_[state].base = new_base;
+    owned_states_[new_base + code].check = state;
+    return new_base + code;
   }
 
-  TrieNode* root_;
+  vector<uint32_t> ChildCodes(int32_t state) const {
+    vector<uint32_t> codes;
+    int32_t base = owned_states_[state].base;
+    if (base == 0) {
+      return codes;
+    }
+    for (uint32_t code = 1; code <= code_num_ && size_t(base) + code < owned_states_.size(); code++) {
+      if (owned_states_[base + code].check == state) {
+        codes.push_back(code);
+      }
+    }
+    return codes;
+  }
+
+  // read through these; they point into owned_* or into saved arrays
+  const State* states_;
+  size_t state_num_;
+  const uint32_t* codes_;             // rune -> code for runes below DIRECT_CODES
+
+  vector<State> owned_states_;
+  vector<uint32_t> owned_codes_;
+  unordered_map<Rune, uint32_t> wide_codes_;
+  uint32_t code_num_;
+  vector<const DictUnit*> values_;    // words, referred to by State::value
+  vector<size_t> next_check_pos_;     // per log2(children) class, only used while building
 }; // class Trie
 } // namespace cppjieba
 
@@ -4,12 +4,13 @@
 #include <cstring>
 
 const string input = "data/raw_html/raw.txt";
+const string index_file = "data/index/index.bin";
 
 int main()
 {
     // 测试
     Searcher *search = new Searcher();
-    search->InitSearcher(input);
+    search->InitSearcher(input, index_file);
 
     string query;
     string json_string;
@@ -0,0 +1,41 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "cppjieba/Jieba.hpp"
+#include "dict_path.hpp"
+#include "log.hpp"
+
+// 离线编译词库: 解析dict下的文本词库, 把词典, 双数组trie, HMM模型, idf和暂停词写成一个二进制镜像
+// parser, debug和http_server启动时直接mmap这个镜像, 不需要再解析文本, trie也不用重新建立
+// 文本词库改过之后要重新运行, 否则它们会发现镜像过期, 退回去解析文本词库
+
+// ./dict_builder [output], 默认写到DICT_IMAGE_PATH
+int main(int argc, char *argv[])
+{
+    std::string output = argc > 1 ? argv[1] : DICT_IMAGE_PATH;
+
+    auto start = std::chrono::steady_clock::now();
+    cppjieba::Jieba jieba(DICT_PATH, HMM_PATH, USER_DICT_PATH, IDF_PATH, STOP_WORD_PATH);
+    double parse_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!jieba.SaveImage(output, DictSources()))
+    {
+        std::cerr << "save dict image error!" << std::endl;
+        return 1;
+    }
+
+    // 重新映射一遍, 确认写出来的镜像能用
+    start = std::chrono::steady_clock::now();
+    cppjieba::DictImage image;
+    if (!image.Open(output))
+    {
+        std::cerr << "load dict image error!" << std::endl;
+        return 2;
+    }
+    cppjieba::Jieba loaded(image);
+    double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    logMsg(NORMAL, "词典镜像写入成功: %s, %.1f MB, 解析文本词库 %.3f s, 加载镜像 %.3f s", output.c_str(),
+           image.Header().file_size / (1024.0 * 1024.0), parse_seconds, load_seconds);
+    return 0;
+}
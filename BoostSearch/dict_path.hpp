@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// 引入词库路径
+const char* const DICT_PATH = "./dict/jieba.dict.utf8";
+const char* const HMM_PATH = "./dict/hmm_model.utf8";
+const char* const USER_DICT_PATH = "./dict/user.dict.utf8";
+const char* const IDF_PATH = "./dict/idf.utf8";
+const char* const STOP_WORD_PATH = "./dict/stop_words.utf8";    // 这里面存放的就是暂停词
+
+// dict_builder把上面的文本词库编译成这个二进制镜像, 启动时直接mmap, 不用再解析文本
+const char* const DICT_IMAGE_PATH = "./dict/jieba.image";
+
+// 镜像中记录这些文件的大小和修改时间, 文本词库改过之后镜像就过期了
+inline std::vector<std::string> DictSources()
+{
+    return {DICT_PATH, HMM_PATH, USER_DICT_PATH, IDF_PATH, STOP_WORD_PATH};
+}
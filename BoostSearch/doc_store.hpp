@@ -0,0 +1,163 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <zlib.h>
+
+// 文档正文的压缩存储
+// 相邻的文档正文拼接起来, 每攒够CONTENT_BLOCK_SIZE字节压缩成一个块(zlib), 一个文档不会跨块
+// 只在生成摘要的时候才需要正文, 这时只解压这个文档所在的那一个块
+// 块的数据在内存中(刚建立的段)或者在mmap映射的索引文件中(加载的段)
+const uint32_t CONTENT_BLOCK_SIZE = 16 * 1024;
+
+// 一个文档的正文在哪个块的什么位置(也是索引文件中的格式)
+struct DocContent
+{
+    uint32_t block;
+    uint32_t offset;   // 在解压之后的块中的偏移量
+    uint32_t length;
+    uint32_t reserved;
+};
+
+// 一个压缩块(也是索引文件中的格式)
+struct ContentBlock
+{
+    uint64_t offset;          // 相对正文区开头的偏移量
+    uint32_t compressed_size;
+    uint32_t raw_size;
+};
+
+class DocStore
+{
+private:
+    std::vector<DocContent> docs;     // 下标是doc_id
+    std::vector<ContentBlock> blocks;
+    const char *data;                 // 正文区: 指向pool或者映射的索引文件
+    std::string pool;                 // 内存中建立的正文区
+
+    DocStore(const DocStore&) = delete;
+    DocStore& operator=(const DocStore&) = delete;
+
+public:
+    DocStore()
+        : data(nullptr)
+    {}
+
+    // 压缩doc_count个文档的正文, get_text(i)返回doc_id为i的文档正文
+    template <class GetText>
+    void Build(size_t doc_count, GetText get_text)
+    {
+        docs.assign(doc_count, DocContent());
+        blocks.clear();
+        pool.clear();
+
+        std::string raw;
+        for (size_t i = 0; i < doc_count; i++)
+        {
+            const std::string &text = get_text(i);
+            DocContent &doc = docs[i];
+            doc.block = (uint32_t)blocks.size();
+            doc.offset = (uint32_t)raw.size();
+            doc.length = (uint32_t)text.size();
+            doc.reserved = 0;
+            raw += text;
+            if (raw.size() >= CONTENT_BLOCK_SIZE)
+            {
+                Flush(&raw);
+            }
+        }
+        Flush(&raw);
+        data = pool.data();
+    }
+
+    // 使用索引文件中已经压缩好的正文区
+    void Attach(const DocContent *file_docs, size_t doc_count,
+                const ContentBlock *file_blocks, size_t block_count, const char *content)
+    {
+        docs.assign(file_docs, file_docs + doc_count);
+        blocks.assign(file_blocks, file_blocks + block_count);
+        std::string().swap(pool);
+        data = content;
+    }
+
+    // 解压出doc_id的正文
+    bool GetContent(uint32_t doc_id, std::string *content) const
+    {
+        if (doc_id >= docs.size())
+        {
+            return false;
+        }
+        const DocContent &doc = docs[doc_id];
+        if (doc.length == 0)
+        {
+            content->clear();
+            return true;
+        }
+        const ContentBlock &block = blocks[doc.block];
+        std::string raw(block.raw_size, '\0');
+        uLongf raw_size = block.raw_size;
+        if (uncompress((Bytef *)&raw[0], &raw_size, (const Bytef *)(data + block.offset), block.compressed_size) != Z_OK
+            || raw_size != block.raw_size || (uint64_t)doc.offset + doc.length > raw_size)
+        {
+            std::cerr << "doc " << doc_id << " content corrupted!" << std::endl;
+            return false;
+        }
+        content->assign(raw, doc.offset, doc.length);
+        return true;
+    }
+
+    const std::vector<DocContent> &Docs() const { return docs; }
+    const std::vector<ContentBlock> &Blocks() const { return blocks; }
+
+    // 正文区的大小
+    uint64_t DataSize() const
+    {
+        return blocks.empty() ? 0 : blocks.back().offset + blocks.back().compressed_size;
+    }
+    const char *Data() const { return data; }
+
+    // 检查文件中的块表和文档表是否都在正文区内
+    static bool Check(const DocContent *file_docs, size_t doc_count,
+                      const ContentBlock *file_blocks, size_t block_count, uint64_t content_size)
+    {
+        for (size_t i = 0; i < block_count; i++)
+        {
+            if (file_blocks[i].offset > content_size || file_blocks[i].compressed_size > content_size - file_blocks[i].offset)
+            {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < doc_count; i++)
+        {
+            if (file_docs[i].length > 0 && (file_docs[i].block >= block_count
+                || (uint64_t)file_docs[i].offset + file_docs[i].length > file_blocks[file_docs[i].block].raw_size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    void Flush(std::string *raw)
+    {
+        if (raw->empty())
+        {
+            return;
+        }
+        uLongf size = compressBound(raw->size());
+        size_t start = pool.size();
+        pool.resize(start + size);
+        compress2((Bytef *)&pool[start], &size, (const Bytef *)raw->data(), raw->size(), Z_DEFAULT_COMPRESSION);
+        pool.resize(start + size);
+
+        ContentBlock block;
+        block.offset = start;
+        block.compressed_size = (uint32_t)size;
+        block.raw_size = (uint32_t)raw->size();
+        blocks.push_back(block);
+        raw->clear();
+    }
+};
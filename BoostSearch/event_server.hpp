@@ -0,0 +1,925 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "log.hpp"
+
+// 基于epoll(边沿触发)的HTTP服务器, 只支持GET/HEAD, 支持keep-alive和流水线请求
+// 一个I/O线程负责accept, 读, 解析请求和写响应, 都是非阻塞的; 只有解析完整的请求才交给工作线程处理
+// 空闲的keep-alive连接只占一个fd和一点缓冲区, 不占工作线程, 所以几个线程就能维持成千上万个连接
+// 一个连接同一时间只有一个请求在处理, 处理完之后才解析它后面的请求, 保证响应的顺序
+// 接口仿照httplib: Get注册处理函数, set_base_dir设置静态文件目录, listen开始服务
+// 准入控制: 注册时带了代价函数的请求, I/O线程先估计它的代价, 排队的请求太多或者代价之和超过预算时
+// 直接回复503和Retry-After, 不进队列; 这样被接受的请求的排队时间有上限, 过载时尾延迟不会无限增长
+const size_t HTTP_MAX_HEADER = 16 * 1024;        // 请求行加请求头的最大长度
+const size_t HTTP_MAX_BODY = 1024 * 1024;        // GET请求一般没有body, 有的话读完丢掉
+const size_t HTTP_READ_CHUNK = 16 * 1024;
+const int HTTP_KEEP_ALIVE_TIMEOUT = 60;          // 秒, 空闲连接超时关闭
+const int HTTP_MAX_EVENTS = 256;
+
+struct HttpRequest
+{
+    std::string method;
+    std::string path;          // 已经解码, 不含参数
+    std::string version;
+    std::unordered_map<std::string, std::string> params; // 参数, 已经解码, 同名的只保留第一个
+    std::unordered_map<std::string, std::string> headers; // 名字转成了小写
+    std::string remote_addr;
+    bool keep_alive;
+
+    HttpRequest()
+        : keep_alive(true)
+    {}
+
+    bool has_param(const std::string &key) const { return params.count(key) > 0; }
+
+    std::string get_param_value(const std::string &key) const
+    {
+        auto iter = params.find(key);
+        return iter == params.end() ? "" : iter->second;
+    }
+};
+
+struct HttpResponse
+{
+    int status;
+    std::string body;
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    HttpResponse()
+        : status(200)
+    {}
+
+    void set_content(const std::string &content, const char *content_type)
+    {
+        body = content;
+        set_header("Content-Type", content_type);
+    }
+
+    void set_header(const std::string &name, const std::string &value)
+    {
+        headers.emplace_back(name, value);
+    }
+};
+
+class EventServer
+{
+public:
+    typedef std::function<void(const HttpRequest &, HttpResponse &)> Handler;
+    typedef std::function<uint64_t(const HttpRequest &)> CostFunc; // 在I/O线程中调用, 要快
+
+private:
+    // 一个连接, 只在I/O线程中访问
+    struct Connection
+    {
+        int fd;
+        uint64_t id;         // 连接的编号, fd会被复用, 工作线程用编号找回连接
+        std::string remote_addr;
+        std::string in;      // 读到的还没有解析的数据
+        std::string out;     // 还没有写出去的响应
+        size_t out_pos;
+        bool busy;           // 有一个请求在工作线程中
+        bool close_after_write;
+        bool peer_closed;
+        time_t last_active;
+    };
+
+    struct Route
+    {
+        Handler handler;
+        CostFunc cost; // 为空表示不受准入控制
+    };
+
+    // 交给工作线程的请求
+    struct Task
+    {
+        uint64_t conn_id;
+        HttpRequest request;
+        bool limited; // 受准入控制, 计入queued和pending_cost
+        uint64_t cost;
+    };
+
+    // 工作线程处理完的响应
+    struct Completion
+    {
+        uint64_t conn_id;
+        std::string data;
+        bool keep_alive;
+    };
+
+    std::unordered_map<std::string, Route> routes;
+    std::string base_dir;
+    size_t worker_count;
+
+    int epoll_fd;
+    int listen_fd;
+    int event_fd; // 工作线程用它唤醒I/O线程
+    uint64_t next_id;
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections;
+    std::unordered_map<int, uint64_t> fd_ids;
+
+    std::mutex task_mtx;
+    std::condition_variable task_cond;
+    std::deque<Task> tasks;
+    size_t queued;          // tasks中受准入控制的请求数
+    uint64_t pending_cost;  // 受准入控制的请求(排队的和正在处理的)的代价之和
+
+    // 准入控制的参数, listen之前设置
+    size_t max_queue;       // 0表示不限制
+    uint64_t max_cost;      // 0表示不限制
+    int retry_after;        // 秒
+    std::atomic<uint64_t> rejected_queue;
+    std::atomic<uint64_t> rejected_cost;
+
+    std::mutex done_mtx;
+    std::vector<Completion> done;
+
+    EventServer(const EventServer&) = delete;
+    EventServer& operator=(const EventServer&) = delete;
+
+public:
+    // worker_count: 工作线程数, 0表示和CPU核数相同
+    explicit EventServer(size_t worker_count = 0)
+        : worker_count(worker_count), epoll_fd(-1), listen_fd(-1), event_fd(-1), next_id(1),
+          queued(0), pending_cost(0), max_queue(0), max_cost(0), retry_after(1),
+          rejected_queue(0), rejected_cost(0)
+    {}
+
+    // cost: 估计请求的代价, 为空表示这个路径不受准入控制
+    void Get(const std::string &path, Handler handler, CostFunc cost = CostFunc())
+    {
+        Route &route = routes[path];
+        route.handler = handler;
+        route.cost = cost;
+    }
+
+    // max_queue: 最多有多少个请求排队等待工作线程, 0表示不限制
+    // max_cost: 排队的和正在处理的请求的代价之和的上限, 0表示不限制; 没有其它请求时, 代价再大也接受
+    // retry_after: 拒绝时建议客户端多少秒之后重试
+    void set_admission(size_t max_queue, uint64_t max_cost, int retry_after)
+    {
+        this->max_queue = max_queue;
+        this->max_cost = max_cost;
+        this->retry_after = retry_after;
+    }
+
+    uint64_t RejectedByQueue() const { return rejected_queue.load(std::memory_order_relaxed); }
+    uint64_t RejectedByCost() const { return rejected_cost.load(std::memory_order_relaxed); }
+
+    // 受准入控制的请求: 排队的个数和(排队的和正在处理的)代价之和
+    void QueueState(size_t *depth, uint64_t *cost)
+    {
+        std::lock_guard<std::mutex> lock(task_mtx);
+        *depth = queued;
+        *cost = pending_cost;
+    }
+
+    // 没有注册处理函数的路径到这个目录下找静态文件, "/"对应index.html
+    void set_base_dir(const char *dir)
+    {
+        base_dir = dir;
+    }
+
+    // 开始服务, 不会返回; 监听失败时返回false
+    bool listen(const char *host, int port)
+    {
+        if (!Open(host, port))
+        {
+            return false;
+        }
+        size_t n = worker_count ? worker_count : std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < n; i++)
+        {
+            std::thread([this]{ Work(); }).detach();
+        }
+        logMsg(NORMAL, "监听 %s:%d, 工作线程数: %lu", host, port, (unsigned long)n);
+        Loop();
+        return true;
+    }
+
+private:
+    bool Open(const char *host, int port)
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+        {
+            logMsg(FATAL, "socket失败: %s", strerror(errno));
+            return false;
+        }
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1
+            || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || ::listen(listen_fd, SOMAXCONN) < 0)
+        {
+            logMsg(FATAL, "监听 %s:%d 失败: %s", host, port, strerror(errno));
+            return false;
+        }
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || event_fd < 0)
+        {
+            logMsg(FATAL, "epoll初始化失败: %s", strerror(errno));
+            return false;
+        }
+        Watch(listen_fd, EPOLLIN | EPOLLET);
+        Watch(event_fd, EPOLLIN | EPOLLET);
+        return true;
+    }
+
+    void Watch(int fd, uint32_t events)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // I/O线程
+    void Loop()
+    {
+        struct epoll_event events[HTTP_MAX_EVENTS];
+        time_t last_sweep = time(nullptr);
+        while (true)
+        {
+            int n = epoll_wait(epoll_fd, events, HTTP_MAX_EVENTS, 1000);
+            if (n < 0 && errno != EINTR)
+            {
+                logMsg(ERROR, "epoll_wait失败: %s", strerror(errno));
+            }
+            for (int i = 0; i < n; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd)
+                {
+                    AcceptAll();
+                }
+                else if (fd == event_fd)
+                {
+                    uint64_t value;
+                    while (read(event_fd, &value, sizeof(value)) > 0)
+                    {}
+                    Complete();
+                }
+                else
+                {
+                    OnEvent(fd, events[i].events);
+                }
+            }
+            time_t now = time(nullptr);
+            if (now != last_sweep)
+            {
+                last_sweep = now;
+                CloseIdle(now);
+            }
+        }
+    }
+
+    void AcceptAll()
+    {
+        while (true)
+        {
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            int fd = accept4(listen_fd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    logMsg(WARNING, "accept失败: %s", strerror(errno));
+                }
+                return;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            std::unique_ptr<Connection> conn(new Connection());
+            conn->fd = fd;
+            conn->id = next_id++;
+            char ip[INET_ADDRSTRLEN] = {0};
+            inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+            conn->remote_addr = ip;
+            conn->out_pos = 0;
+            conn->busy = conn->close_after_write = conn->peer_closed = false;
+            conn->last_active = time(nullptr);
+            fd_ids[fd] = conn->id;
+            connections[conn->id] = std::move(conn);
+            Watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        }
+    }
+
+    void OnEvent(int fd, uint32_t events)
+    {
+        auto iter = fd_ids.find(fd);
+        if (iter == fd_ids.end())
+        {
+            return;
+        }
+        Connection *conn = connections[iter->second].get();
+        if (events & (EPOLLERR | EPOLLHUP))
+        {
+            Close(conn);
+            return;
+        }
+        if (events & EPOLLOUT)
+        {
+            if (!Flush(conn))
+            {
+                return;
+            }
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP))
+        {
+            if (!ReadAll(conn))
+            {
+                return;
+            }
+            Process(conn);
+        }
+    }
+
+    // 读到EAGAIN为止(边沿触发必须读完); 连接被关闭时返回false
+    bool ReadAll(Connection *conn)
+    {
+        char buf[HTTP_READ_CHUNK];
+        while (true)
+        {
+            ssize_t n = read(conn->fd, buf, sizeof(buf));
+            if (n > 0)
+            {
+                conn->in.append(buf, n);
+                conn->last_active = time(nullptr);
+                if (conn->in.size() > HTTP_MAX_HEADER + HTTP_MAX_BODY + HTTP_READ_CHUNK)
+                {
+                    Close(conn); // 流水线中堆积了太多还没有处理的请求
+                    return false;
+                }
+                continue;
+            }
+            if (n == 0)
+            {
+                conn->peer_closed = true;
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            Close(conn);
+            return false;
+        }
+        return true;
+    }
+
+    // 解析出一个完整的请求就交给工作线程; 连接被关闭时返回false
+    bool Process(Connection *conn)
+    {
+        while (!conn->busy && !conn->close_after_write)
+        {
+            size_t end = conn->in.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                if (conn->in.size() > HTTP_MAX_HEADER)
+                {
+                    return Reject(conn, 431, "Request Header Fields Too Large");
+                }
+                break;
+            }
+            Task task;
+            task.conn_id = conn->id;
+            size_t body_length = 0;
+            if (end > HTTP_MAX_HEADER)
+            {
+                return Reject(conn, 431, "Request Header Fields Too Large");
+            }
+            if (!ParseHeader(conn->in.substr(0, end), &task.request, &body_length))
+            {
+                return Reject(conn, 400, "Bad Request");
+            }
+            if (body_length > HTTP_MAX_BODY)
+            {
+                return Reject(conn, 413, "Payload Too Large");
+            }
+            if (conn->in.size() < end + 4 + body_length)
+            {
+                break; // body还没有读完
+            }
+            conn->in.erase(0, end + 4 + body_length);
+            task.request.remote_addr = conn->remote_addr;
+            if (task.request.method != "GET" && task.request.method != "HEAD")
+            {
+                return Reject(conn, 405, "Method Not Allowed");
+            }
+            Estimate(&task);
+            if (!Dispatch(std::move(task)))
+            {
+                if (!Overloaded(conn, task.request))
+                {
+                    return false;
+                }
+                continue;
+            }
+            conn->busy = true;
+        }
+        if (conn->peer_closed && !conn->busy && conn->out_pos == conn->out.size())
+        {
+            Close(conn);
+            return false;
+        }
+        return true;
+    }
+
+    // 回复一个错误然后关闭连接
+    bool Reject(Connection *conn, int status, const char *reason)
+    {
+        HttpResponse rsp;
+        rsp.status = status;
+        rsp.set_content(std::string(reason) + "\n", "text/plain; charset=utf-8");
+        conn->out += Serialize(rsp, false, false);
+        conn->in.clear();
+        conn->close_after_write = true;
+        return Flush(conn);
+    }
+
+    void Estimate(Task *task)
+    {
+        task->limited = false;
+        task->cost = 0;
+        auto iter = routes.find(task->request.path);
+        if (iter == routes.end() || !iter->second.cost)
+        {
+            return;
+        }
+        task->limited = true;
+        try
+        {
+            task->cost = iter->second.cost(task->request);
+        }
+        catch (const std::exception &e)
+        {
+            logMsg(WARNING, "估计 %s 的代价失败: %s", task->request.path.c_str(), e.what());
+        }
+    }
+
+    // 放进队列; 受准入控制的请求超过限制时不放, 返回false, task保持不变
+    bool Dispatch(Task &&task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(task_mtx);
+            if (task.limited)
+            {
+                if (max_queue > 0 && queued >= max_queue)
+                {
+                    rejected_queue.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (max_cost > 0 && pending_cost > 0 && pending_cost + task.cost > max_cost)
+                {
+                    rejected_cost.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                queued++;
+                pending_cost += task.cost;
+            }
+            tasks.push_back(std::move(task));
+        }
+        task_cond.notify_one();
+        return true;
+    }
+
+    // 过载: 在I/O线程直接回复503, 连接保持; 连接被关闭时返回false
+    bool Overloaded(Connection *conn, const HttpRequest &req)
+    {
+        HttpResponse rsp;
+        rsp.status = 503;
+        rsp.set_content("Service Unavailable\n", "text/plain; charset=utf-8");
+        rsp.set_header("Retry-After", std::to_string(retry_after));
+        conn->out += Serialize(rsp, req.method != "HEAD", req.keep_alive);
+        if (!req.keep_alive)
+        {
+            conn->close_after_write = true;
+        }
+        return Flush(conn);
+    }
+
+    // 工作线程: 取请求, 处理, 把响应交回I/O线程
+    void Work()
+    {
+        while (true)
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(task_mtx);
+                task_cond.wait(lock, [this]{ return !tasks.empty(); });
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                if (task.limited)
+                {
+                    queued--;
+                }
+            }
+            HttpResponse rsp;
+            try
+            {
+                Handle(task.request, &rsp);
+            }
+            catch (const std::exception &e)
+            {
+                logMsg(ERROR, "处理 %s 失败: %s", task.request.path.c_str(), e.what());
+                rsp = HttpResponse();
+                rsp.status = 500;
+                rsp.set_content("Internal Server Error\n", "text/plain; charset=utf-8");
+            }
+            if (task.limited)
+            {
+                std::lock_guard<std::mutex> lock(task_mtx);
+                pending_cost -= task.cost;
+            }
+            Completion completion;
+            completion.conn_id = task.conn_id;
+            completion.keep_alive = task.request.keep_alive;
+            completion.data = Serialize(rsp, task.request.method != "HEAD", task.request.keep_alive);
+            {
+                std::lock_guard<std::mutex> lock(done_mtx);
+                done.push_back(std::move(completion));
+            }
+            uint64_t one = 1;
+            ssize_t ret = write(event_fd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    void Handle(const HttpRequest &req, HttpResponse *rsp)
+    {
+        auto iter = routes.find(req.path);
+        if (iter != routes.end())
+        {
+            iter->second.handler(req, *rsp);
+            return;
+        }
+        if (!base_dir.empty() && ServeFile(req.path, rsp))
+        {
+            return;
+        }
+        rsp->status = 404;
+        rsp->set_content("Not Found\n", "text/plain; charset=utf-8");
+    }
+
+    // I/O线程: 把工作线程处理完的响应写出去, 再解析同一个连接后面的请求
+    void Complete()
+    {
+        std::vector<Completion> batch;
+        {
+            std::lock_guard<std::mutex> lock(done_mtx);
+            batch.swap(done);
+        }
+        for (auto &completion : batch)
+        {
+            auto iter = connections.find(completion.conn_id);
+            if (iter == connections.end())
+            {
+                continue; // 连接已经关闭了
+            }
+            Connection *conn = iter->second.get();
+            conn->busy = false;
+            conn->last_active = time(nullptr);
+            conn->out += completion.data;
+            if (!completion.keep_alive)
+            {
+                conn->close_after_write = true;
+            }
+            if (Flush(conn))
+            {
+                Process(conn);
+            }
+        }
+    }
+
+    // 写到EAGAIN或者写完为止; 连接被关闭时返回false
+    bool Flush(Connection *conn)
+    {
+        while (conn->out_pos < conn->out.size())
+        {
+            ssize_t n = send(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos, MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                conn->out_pos += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return true; // 等EPOLLOUT
+            }
+            Close(conn);
+            return false;
+        }
+        conn->out.clear();
+        conn->out_pos = 0;
+        if (conn->close_after_write && !conn->busy)
+        {
+            Close(conn);
+            return false;
+        }
+        return true;
+    }
+
+    void Close(Connection *conn)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        fd_ids.erase(conn->fd);
+        connections.erase(conn->id); // conn在这里被释放
+    }
+
+    void CloseIdle(time_t now)
+    {
+        std::vector<Connection *> idle;
+        for (auto &pair : connections)
+        {
+            Connection *conn = pair.second.get();
+            if (!conn->busy && now - conn->last_active > HTTP_KEEP_ALIVE_TIMEOUT)
+            {
+                idle.push_back(conn);
+            }
+        }
+        for (auto conn : idle)
+        {
+            Close(conn);
+        }
+    }
+
+    // 解析请求行和请求头, body_length是Content-Length
+    static bool ParseHeader(const std::string &header, HttpRequest *req, size_t *body_length)
+    {
+        std::istringstream in(header);
+        std::string line;
+        if (!std::getline(in, line))
+        {
+            return false;
+        }
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        size_t sp1 = line.find(' ');
+        size_t sp2 = line.rfind(' ');
+        if (sp1 == std::string::npos || sp2 == sp1)
+        {
+            return false;
+        }
+        req->method = line.substr(0, sp1);
+        std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        req->version = line.substr(sp2 + 1);
+        if (req->version != "HTTP/1.1" && req->version != "HTTP/1.0")
+        {
+            return false;
+        }
+        size_t query = target.find('?');
+        if (!Decode(target.substr(0, query), false, &req->path) || req->path.empty() || req->path[0] != '/')
+        {
+            return false;
+        }
+        if (query != std::string::npos && !ParseQuery(target.substr(query + 1), &req->params))
+        {
+            return false;
+        }
+
+        while (std::getline(in, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+            {
+                return false;
+            }
+            std::string name = line.substr(0, colon);
+            for (auto &c : name)
+            {
+                c = (char)tolower((unsigned char)c);
+            }
+            size_t begin = line.find_first_not_of(" \t", colon + 1);
+            req->headers[name] = begin == std::string::npos ? "" : line.substr(begin);
+        }
+
+        // HTTP/1.1默认keep-alive, HTTP/1.0默认关闭
+        std::string connection = req->headers.count("connection") ? req->headers["connection"] : "";
+        for (auto &c : connection)
+        {
+            c = (char)tolower((unsigned char)c);
+        }
+        req->keep_alive = (req->version == "HTTP/1.1") ? connection != "close" : connection == "keep-alive";
+
+        *body_length = 0;
+        if (req->headers.count("transfer-encoding"))
+        {
+            return false; // 不支持chunked的请求body
+        }
+        if (req->headers.count("content-length"))
+        {
+            const std::string &value = req->headers["content-length"];
+            char *end = nullptr;
+            unsigned long long n = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || value[0] == '-')
+            {
+                return false;
+            }
+            *body_length = n > HTTP_MAX_BODY ? HTTP_MAX_BODY + 1 : (size_t)n;
+        }
+        return true;
+    }
+
+    // a=1&b=2, 同名的参数只保留第一个
+    static bool ParseQuery(const std::string &query, std::unordered_map<std::string, std::string> *params)
+    {
+        size_t pos = 0;
+        while (pos <= query.size())
+        {
+            size_t amp = query.find('&', pos);
+            if (amp == std::string::npos)
+            {
+                amp = query.size();
+            }
+            std::string pair = query.substr(pos, amp - pos);
+            pos = amp + 1;
+            if (pair.empty())
+            {
+                continue;
+            }
+            size_t eq = pair.find('=');
+            std::string key, value;
+            if (!Decode(pair.substr(0, eq), true, &key)
+                || !Decode(eq == std::string::npos ? "" : pair.substr(eq + 1), true, &value))
+            {
+                return false;
+            }
+            params->emplace(key, value);
+        }
+        return true;
+    }
+
+    // %XX解码, 参数中的'+'是空格
+    static bool Decode(const std::string &s, bool plus_as_space, std::string *out)
+    {
+        out->clear();
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            if (s[i] == '%')
+            {
+                if (i + 2 >= s.size())
+                {
+                    return false;
+                }
+                int hi = Hex(s[i + 1]), lo = Hex(s[i + 2]);
+                if (hi < 0 || lo < 0)
+                {
+                    return false;
+                }
+                out->push_back((char)(hi * 16 + lo));
+                i += 2;
+            }
+            else if (s[i] == '+' && plus_as_space)
+            {
+                out->push_back(' ');
+            }
+            else
+            {
+                out->push_back(s[i]);
+            }
+        }
+        return true;
+    }
+
+    static int Hex(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    static const char *StatusText(int status)
+    {
+        switch (status)
+        {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default:  return "Unknown";
+        }
+    }
+
+    static std::string Serialize(const HttpResponse &rsp, bool with_body, bool keep_alive)
+    {
+        std::string out;
+        out.reserve(rsp.body.size() + 256);
+        char line[128];
+        snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", rsp.status, StatusText(rsp.status));
+        out += line;
+        for (auto &header : rsp.headers)
+        {
+            out += header.first;
+            out += ": ";
+            out += header.second;
+            out += "\r\n";
+        }
+        snprintf(line, sizeof(line), "Content-Length: %lu\r\nConnection: %s\r\n\r\n",
+                 (unsigned long)rsp.body.size(), keep_alive ? "keep-alive" : "close");
+        out += line;
+        if (with_body)
+        {
+            out += rsp.body;
+        }
+        return out;
+    }
+
+    // 静态文件, 不允许路径中出现".."
+    bool ServeFile(const std::string &path, HttpResponse *rsp) const
+    {
+        if (path.find("..") != std::string::npos)
+        {
+            return false;
+        }
+        std::string file = base_dir + (path.back() == '/' ? path + "index.html" : path);
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            return false;
+        }
+        std::ifstream in(file, std::ios::binary);
+        std::string content((size_t)st.st_size, '\0');
+        if (!in.read(&content[0], content.size()))
+        {
+            return false;
+        }
+        rsp->set_content(content, ContentType(file));
+        return true;
+    }
+
+    static const char *ContentType(const std::string &file)
+    {
+        size_t dot = file.rfind('.');
+        std::string ext = dot == std::string::npos ? "" : file.substr(dot + 1);
+        if (ext == "html" || ext == "htm") return "text/html; charset=utf-8";
+        if (ext == "css") return "text/css; charset=utf-8";
+        if (ext == "js") return "application/javascript; charset=utf-8";
+        if (ext == "json") return "application/json";
+        if (ext == "txt") return "text/plain; charset=utf-8";
+        if (ext == "png") return "image/png";
+        if (ext == "jpg" || ext == "jpeg") return "image/jpeg";
+        if (ext == "gif") return "image/gif";
+        if (ext == "svg") return "image/svg+xml";
+        if (ext == "ico") return "image/x-icon";
+        return "application/octet-stream";
+    }
+};
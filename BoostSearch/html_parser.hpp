@@ -0,0 +1,180 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#include "util.hpp"
+
+// 从boost文档的html网页中提取标题, 正文(去标签)和url
+// parser用它生成raw.txt, index_builder --html用它直接建索引; 需要链接boost_filesystem
+
+struct HtmlDoc
+{
+    std::string title;      //文档的标题
+    std::string content;    //文档内容
+    std::string url;        //该文档在官网中的url
+};
+
+class HtmlParser
+{
+public:
+    // 使用boost库中的函数来枚举文件名为【.html】的文件, 并保存到【files_list】数组中
+    static bool EnumFile(const std::string &src_path, std::vector<std::string> *files_list)
+    {
+        namespace fs = boost::filesystem;
+        fs::path root_path(src_path);
+
+        // 1.判断路径是否存在, 不存在, 就没有必要再往后走了
+        if (!fs::exists(root_path))
+        {
+            std::cerr << src_path << " not exists!" << std::endl;
+            return false;
+        }
+
+        // 2. 文件存在, 对文件进行递归遍历
+        fs::recursive_directory_iterator end; //定义一个空的迭代器，用来进行判断递归结束
+        for (fs::recursive_directory_iterator iter(root_path); iter != end; iter++)
+        {
+            // 判断文件是否是普通文件，html都是普通文件, 诸如: .jpg / .png 等等这种就不行
+            if (!fs::is_regular_file(*iter)) 
+            {
+                continue; // 如果不是普通文件, 那么就跳过, 继续遍历
+            }
+
+            // 如果是普通文件, 那么需要判断该文件后缀是否以【.html】结尾的
+            if (iter->path().extension() != ".html") 
+            {
+                continue;
+            }
+
+            // 走到这里, 当前的路径一定是一个合法的, 以【.html】结束的普通网页文件
+            //logMsg(DEBUG, "%s", iter->path().string().c_str()); // 测试
+            files_list->push_back(iter->path().string()); //将所有带路径的html保存在files_list,方便后续进行文本分析
+        }
+        // 目录遍历的顺序取决于文件系统, 排个序, 保证每次生成的raw.txt(以及doc_id)都一样
+        std::sort(files_list->begin(), files_list->end());
+        return true;
+    }
+
+    // 读取并解析src_path下的一个文件, bytes: 读到的字节数(累加)
+    // hash不为空时放文件内容的hash; 读成功但解析失败(比如没有标题)时也会设置
+    static bool ParseFile(const std::string &src_path, const std::string &file, HtmlDoc *doc, size_t *bytes,
+                          uint64_t *hash = nullptr)
+    {
+        // 1.读取文件, Read();
+        // 每个线程复用同一块缓冲区, 不用每个文件都重新分配
+        static thread_local std::string result; // 存放读取到的文件
+        result.clear();
+        if (!FileUtil::ReadFile(file, &result))
+        {
+            return false;
+        }
+        *bytes += result.size();
+        if (hash != nullptr)
+        {
+            *hash = StringUtil::Hash(result.data(), result.size());
+        }
+
+        // 2.解析指定的文件, 提取title
+        if (!ParseTitle(result, &doc->title))
+        {
+            return false;
+        }
+
+        // 3.解析指定的文件, 提取content(就是去标签)
+        if (!ParseContent(result, &doc->content))
+        {
+            return false;
+        }
+
+        // 4.解析指定的文件路径, 构建url
+        if (!ParseUrl(src_path, file, &doc->url))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // src_path下的文件对应官网上的url
+    static bool ParseUrl(const std::string &src_path, const std::string &file_path, std::string *url)
+    {
+        // std::string url_head = "https://www.boost.org/doc/libs/1_89_0/doc/html";
+        std::string url_head = "https://www.boost.org/doc/libs/latest/doc/html";
+        std::string url_tail = file_path.substr(src_path.size());
+        *url = url_head + url_tail;
+
+        return true;
+    }
+
+private:
+    // <title>HelloWorld</title>
+    static bool ParseTitle(const std::string &file, std::string *title)
+    {
+        // <title>HelloWorld</title>
+        // 此时 begin 指向 <title> 中的 <
+        size_t begin = file.find("<title>");
+        if (begin == std::string::npos)
+        {
+            return false;
+        }
+
+        // <title>HelloWorld</title>
+        // 此时 end 指向 </title> 中的 <
+        size_t end = file.find("</title>", begin);
+        if (end == std::string::npos)
+        {
+            return false;
+        }
+
+        // <title>HelloWorld</title>
+        // 此时 begin 指向 H
+        begin += std::string("<title>").size();
+
+        if (begin > end) 
+        {
+            return false;
+        }
+
+        // 此时就提取出了HelloWorld
+        // 标题跨行时把换行换成空格, \n是raw.txt中文档的分隔符
+        *title = file.substr(begin, end - begin);
+        std::replace(title->begin(), title->end(), '\n', ' ');
+
+        return true;
+    }
+
+    // 去标签: 跳过<...>, 保留标签之间的文本
+    // 用memchr在'<'和'>'之间跳跃(glibc的memchr是向量化的), 标签之间的文本整段拷贝, 不逐个字符判断状态
+    static bool ParseContent(const std::string &file, std::string *content)
+    {
+        const char *p = file.data();
+        const char *end = p + file.size();
+        while (p < end)
+        {
+            // 在标签中: 找到'>'表示标签结束，进入内容区
+            const char *gt = static_cast<const char *>(memchr(p, '>', end - p));
+            if (gt == nullptr)
+            {
+                break;
+            }
+            p = gt + 1;
+
+            // 在内容区: 遇到'<'表示又开始一个新标签, 之间的文本整段拷贝
+            const char *lt = static_cast<const char *>(memchr(p, '<', end - p));
+            if (lt == nullptr)
+            {
+                lt = end;
+            }
+            size_t old_size = content->size();
+            content->append(p, lt - p);
+            // 我们不想保留原始文件中的\n, 因为我们想用\n作为html解析之后文本的分隔符
+            std::replace(content->begin() + old_size, content->end(), '\n', ' ');
+            p = lt + 1;
+        }
+
+        return true;
+    }
+};
@@ -1,32 +1,267 @@
 #include "searcher.hpp"
-#include "httplib.h"
+#include "event_server.hpp"
 #include "log.hpp"
+#include "conf.hpp"
+#include "html_parser.hpp"
+#include "input_watcher.hpp"
+#include <signal.h>
+#include <pthread.h>
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
 
 const string input = "data/raw_html/raw.txt";
+const string index_file = "data/index/index.bin";
+const string update_file = "data/raw_html/update.txt"; // 增量更新的文档, 格式和raw.txt相同
+const string delete_file = "data/raw_html/delete.txt"; // 增量更新时删除的文档的url, 每行一个(parser增量解析生成)
 const std::string root_path = "./wwwroot";
+const string src_path = "data/input"; // watch_input: 监视这个目录下的原始网页
+
+// 每收到一次SIGHUP就重新加载一次索引
+// SIGHUP在所有线程中都被屏蔽了, 只在这个线程中用sigwait同步地接收
+static void ReloadOnSighup(Searcher *search)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    while (true)
+    {
+        int sig = 0;
+        if (sigwait(&set, &sig) == 0 && sig == SIGHUP)
+        {
+            logMsg(NORMAL, "收到SIGHUP, 重新加载索引...");
+            search->ReloadIndex();
+        }
+    }
+}
+
+// 监视到data/input下的变化: 只解析变化了的网页, 加入内存段; 删除的(或者解析不出来了的)网页从索引中删除
+// 这些变化不会写回raw.txt和索引文件, 重新加载索引之后就没有了, 需要运行parser(增量)和index_builder
+static void ApplyInputChanges(Searcher *search, const vector<string> &changed, const vector<string> &removed)
+{
+    auto start = chrono::steady_clock::now();
+    vector<DocInfo> docs;
+    vector<string> deleted;
+    for (auto &file : changed)
+    {
+        HtmlDoc html;
+        size_t bytes = 0;
+        if (!HtmlParser::ParseFile(src_path, file, &html, &bytes))
+        {
+            string url;
+            HtmlParser::ParseUrl(src_path, file, &url);
+            deleted.push_back(url);
+            continue;
+        }
+        DocInfo doc;
+        doc.title = move(html.title);
+        doc.content = move(html.content);
+        doc.url = move(html.url);
+        doc.doc_id = 0; // 加入段的时候再分配
+        doc.title_len = doc.content_len = 0; // 分词的时候再统计
+        docs.push_back(move(doc));
+    }
+    for (auto &file : removed)
+    {
+        string url;
+        HtmlParser::ParseUrl(src_path, file, &url);
+        deleted.push_back(url);
+    }
+    size_t added = docs.size();
+    search->AddDocuments(move(docs), deleted);
+    logMsg(NORMAL, "%s下有变化: 加入%lu个文档, 删除%lu个文档, 用时%.3fs, 索引版本: %lu", src_path.c_str(),
+           (unsigned long)added, (unsigned long)deleted.size(),
+           chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+           (unsigned long)Index::GetInstance()->GetSnapshot()->version);
+}
+
+// 读取非负整数参数, 没有或者不合法时返回default_value
+static size_t GetSizeParam(const HttpRequest &req, const char *name, size_t default_value)
+{
+    if (!req.has_param(name))
+    {
+        return default_value;
+    }
+    std::string value = req.get_param_value(name);
+    char *end = nullptr;
+    unsigned long long n = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || value[0] == '-')
+    {
+        return default_value;
+    }
+    return (size_t)std::min<unsigned long long>(n, SIZE_MAX);
+}
+
+// 按Prometheus文本格式追加一个没有标签的指标
+static void AppendMetric(std::string *out, const char *name, const char *type, const char *help, double value)
+{
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+    out->append(buffer);
+}
+
+// /metrics: 查询各阶段的耗时, QPS, 缓存命中, 准入控制, 索引大小
+static void WriteMetrics(Searcher &search, EventServer &svr, std::string *out)
+{
+    search.GetMetrics().WritePrometheus(out);
+
+    QueryCache &cache = search.GetCache();
+    size_t entries = 0, bytes = 0;
+    cache.Usage(&entries, &bytes);
+    AppendMetric(out, "boost_search_cache_hits_total", "counter", "Query cache hits.", (double)cache.Hits());
+    AppendMetric(out, "boost_search_cache_misses_total", "counter", "Query cache misses.", (double)cache.Misses());
+    AppendMetric(out, "boost_search_cache_evictions_total", "counter", "Query cache entries evicted for space.", (double)cache.Evictions());
+    AppendMetric(out, "boost_search_cache_invalidations_total", "counter", "Query cache entries dropped by index updates.", (double)cache.Invalidations());
+    AppendMetric(out, "boost_search_cache_entries", "gauge", "Query cache entries.", (double)entries);
+    AppendMetric(out, "boost_search_cache_bytes", "gauge", "Approximate query cache memory.", (double)bytes);
+
+    size_t queue_depth = 0;
+    uint64_t queue_cost = 0;
+    svr.QueueState(&queue_depth, &queue_cost);
+    AppendMetric(out, "boost_search_rejected_queue_total", "counter", "Queries rejected with 503 because the queue was full.", (double)svr.RejectedByQueue());
+    AppendMetric(out, "boost_search_rejected_cost_total", "counter", "Queries rejected with 503 because the cost budget was exceeded.", (double)svr.RejectedByCost());
+    AppendMetric(out, "boost_search_queue_depth", "gauge", "Queries waiting for a worker.", (double)queue_depth);
+    AppendMetric(out, "boost_search_queue_cost", "gauge", "Estimated cost (postings) of queued and running queries.", (double)queue_cost);
+
+    shared_ptr<const IndexSnapshot> snapshot = Index::GetInstance()->GetSnapshot();
+    uint64_t deleted = 0, terms = 0, data_size = 0;
+    for (size_t i = 0; i < snapshot->SegmentCount(); i++)
+    {
+        deleted += snapshot->deletes[i] ? snapshot->deletes[i]->Count() : 0;
+        terms += snapshot->GetSegment(i).TermCount();
+        data_size += snapshot->GetSegment(i).DataSize();
+    }
+    AppendMetric(out, "boost_search_index_version", "gauge", "Version of the published index.", (double)snapshot->version);
+    AppendMetric(out, "boost_search_index_segments", "gauge", "Segments in the index.", (double)snapshot->SegmentCount());
+    AppendMetric(out, "boost_search_index_docs", "gauge", "Live documents in the index.", (double)(snapshot->doc_count - deleted));
+    AppendMetric(out, "boost_search_index_deleted_docs", "gauge", "Deleted documents not merged away yet.", (double)deleted);
+    AppendMetric(out, "boost_search_index_terms", "gauge", "Terms summed over segments.", (double)terms);
+    AppendMetric(out, "boost_search_index_bytes", "gauge", "Postings, positions and compressed content.", (double)data_size);
+}
 
 int main()
 {
+    // 先屏蔽SIGHUP再创建其它线程, 之后创建的线程都会继承这个屏蔽字
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    ServerConf conf;
+    if (!conf.Load(SERVER_CONF_PATH))
+    {
+        logMsg(WARNING, "没有找到配置文件 %s, 使用默认配置", SERVER_CONF_PATH);
+    }
+
     // 获取单例, 建立索引
     Searcher search;
-    search.InitSearcher(input);
+    search.SetCacheBudget(conf.query_cache_mb << 20);
+    search.InitSearcher(input, index_file);
+    Index::GetInstance()->StartMerger(); // 增量更新产生的小段由后台线程合并
+    std::thread(ReloadOnSighup, &search).detach();
 
-    httplib::Server svr;
+    // 可选: 监视data/input, 新的网页几秒之内就能搜到, 不需要重新运行parser和重启
+    std::unique_ptr<InputWatcher> watcher;
+    if (conf.watch_input)
+    {
+        watcher.reset(new InputWatcher(src_path, conf.watch_debounce_ms,
+            [&search](const vector<string> &changed, const vector<string> &removed) {
+                ApplyInputChanges(&search, changed, removed);
+            }));
+        if (!watcher->Start())
+        {
+            logMsg(WARNING, "监视%s失败, 只能通过/admin/update更新索引", src_path.c_str());
+        }
+    }
+
+    EventServer svr(conf.worker_threads);
+    svr.set_admission(conf.max_queue, conf.max_queue_cost, conf.retry_after);
 
     svr.set_base_dir(root_path.c_str()); // 引入wwwroot目录
-    svr.Get("/s", [&search](const httplib::Request &req, httplib::Response &rsp){ 
+    svr.Get("/s", [&search](const HttpRequest &req, HttpResponse &rsp){ 
         if (!req.has_param("word")) 
         {
             rsp.set_content("必须要有搜索关键字!", "text/plain; charset=utf-8");
             return;
         }
         std::string word = req.get_param_value("word");
+        // start: 从排序之后的第几个结果开始返回, count: 返回几个结果
+        size_t start = GetSizeParam(req, "start", 0);
+        size_t count = GetSizeParam(req, "count", SEARCH_PAGE_SIZE);
         //std::cout << "用户在搜索: " << word << std::endl;
-        logMsg(NORMAL, "用户搜索的: %s", word.c_str());
+        logMsg(NORMAL, "用户搜索的: %s, start=%lu, count=%lu", word.c_str(), (unsigned long)start, (unsigned long)count);
         std::string json_string;
-        search.Search(word, &json_string);
+        search.Search(word, &json_string, start, count);
         rsp.set_content(json_string.c_str(), "application/json"); // 给用户返回的结果
+        }, [&search](const HttpRequest &req) -> uint64_t {
+        // 查询的代价: 要遍历的拉链长度之和; 队列满了或者超过预算时直接回复503
+        return search.EstimateCost(req.get_param_value("word"));
+        });
+
+    // 管理接口只允许本机访问
+    // /admin/update: 把update_file中的文档加入索引, 同时删除delete_file中的文档, 几秒之内就能搜到
+    svr.Get("/admin/update", [&search](const HttpRequest &req, HttpResponse &rsp){
+        if (req.remote_addr != "127.0.0.1")
+        {
+            rsp.status = 403;
+            return;
+        }
+        bool ok = search.UpdateIndex(update_file, delete_file);
+        logMsg(NORMAL, "增量更新 %s: %s", update_file.c_str(), ok ? "成功" : "失败");
+        rsp.set_content(ok ? "ok\n" : "update failed\n", "text/plain; charset=utf-8");
+        });
+    // /admin/reload: 在后台重新加载索引, 加载完成之前的请求仍然使用旧索引
+    svr.Get("/admin/reload", [&search](const HttpRequest &req, HttpResponse &rsp){
+        if (req.remote_addr != "127.0.0.1")
+        {
+            rsp.status = 403;
+            return;
+        }
+        std::thread([&search]{ search.ReloadIndex(); }).detach();
+        rsp.set_content("reloading\n", "text/plain; charset=utf-8");
         });
+    // /admin/delete?url=...: 从索引中删除文档
+    svr.Get("/admin/delete", [&search](const HttpRequest &req, HttpResponse &rsp){
+        if (req.remote_addr != "127.0.0.1")
+        {
+            rsp.status = 403;
+            return;
+        }
+        if (!req.has_param("url"))
+        {
+            rsp.set_content("必须要有url!", "text/plain; charset=utf-8");
+            return;
+        }
+        bool ok = search.DeleteDocument(req.get_param_value("url"));
+        rsp.set_content(ok ? "ok\n" : "not found\n", "text/plain; charset=utf-8");
+        });
+
+    // /metrics: Prometheus格式的监控指标
+    svr.Get("/metrics", [&search, &svr](const HttpRequest &req, HttpResponse &rsp){
+        std::string out;
+        WriteMetrics(search, svr, &out);
+        rsp.set_content(out, "text/plain; version=0.0.4; charset=utf-8");
+        });
+
+    // /admin/cache: 查询结果缓存的命中率和淘汰次数
+    svr.Get("/admin/cache", [&search](const HttpRequest &req, HttpResponse &rsp){
+        if (req.remote_addr != "127.0.0.1")
+        {
+            rsp.status = 403;
+            return;
+        }
+        QueryCache &cache = search.GetCache();
+        size_t count = 0, bytes = 0;
+        cache.Usage(&count, &bytes);
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer),
+                 "hits %lu\nmisses %lu\nhit_ratio %.4f\nevictions %lu\ninvalidations %lu\nentries %lu\nbytes %lu\n",
+                 (unsigned long)cache.Hits(), (unsigned long)cache.Misses(), cache.HitRatio(),
+                 (unsigned long)cache.Evictions(), (unsigned long)cache.Invalidations(),
+                 (unsigned long)count, (unsigned long)bytes);
+        rsp.set_content(buffer, "text/plain; charset=utf-8");
+        });
+
     logMsg(NORMAL, "服务器启动成功...");
     svr.listen("0.0.0.0", 8081);
     return 0;
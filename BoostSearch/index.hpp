@@ -4,47 +4,141 @@
 #include <string>
 #include <vector>
 #include <fstream>
-#include <unordered_map>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
 #include "log.hpp"
 #include "util.hpp"
+#include "segment.hpp"
 
 using namespace std;
 
-struct DocInfo
-{
-    string title;      //文档的标题
-    string content;    //文档内容(去标签之后)
-    string url;        //该文档在官网中的url
-    uint64_t doc_id;   //文档的ID
-};
+// 内存段中的文档超过这个数, 内存段就不再接收新文档, 变成普通的只读段
+const uint32_t MEMORY_SEGMENT_DOCS = 1024;
+// 同一层中的只读段达到这个数就合并成一个
+const size_t MERGE_FACTOR = 4;
 
-// 倒排的文件元素
-struct InvertedElem
+// 索引在某一时刻的样子: 一组段和它们被删除的文档, 发布之后就不再修改
+// 查询时先拿到一个快照, 整个查询过程都只看这个快照, 不受同时进行的更新和合并的影响
+// 全局的doc_id = 段的起始编号 + 段内的doc_id, 只在同一个快照内有意义
+class IndexSnapshot
 {
-    uint64_t doc_id;    // ID
-    string word;        // 关键字
-    int weight;         // 权重
+public:
+    uint64_t version;                              // 每发布一次加1
+    vector<shared_ptr<const Segment>> segments;
+    vector<shared_ptr<const DeleteBitmap>> deletes; // 和segments一一对应, nullptr表示没有删除
+    vector<uint64_t> bases;                         // 每个段的起始编号
+    uint64_t doc_count;                             // 所有段的文档数(包括被删除的)
 
-    InvertedElem()
-        : weight(0)
+    IndexSnapshot()
+        : version(0), doc_count(0)
     {}
-};
 
-//倒排拉链
-typedef vector<InvertedElem> InvertedList;
+    size_t SegmentCount() const { return segments.size(); }
+    const Segment &GetSegment(size_t i) const { return *segments[i]; }
+    uint64_t GetBase(size_t i) const { return bases[i]; }
+
+    bool IsDeleted(size_t i, uint32_t doc_id) const
+    {
+        return deletes[i] != nullptr && deletes[i]->Test(doc_id);
+    }
 
+    // 根据doc_id找到找到文档内容(获得正排)
+    const DocInfo *GetForwardIndex(uint64_t doc_id) const
+    {
+        size_t i = FindSegment(doc_id);
+        if (i == segments.size())
+        {
+            cerr << "doc_id out range error!" <<endl;
+            return nullptr;
+        }
+        return segments[i]->GetDoc((uint32_t)(doc_id - bases[i]));
+    }
+
+    // 解压出文档的正文
+    bool GetContent(uint64_t doc_id, string *content) const
+    {
+        size_t i = FindSegment(doc_id);
+        if (i == segments.size())
+        {
+            return false;
+        }
+        return segments[i]->GetContent((uint32_t)(doc_id - bases[i]), content);
+    }
+
+    // 文档doc_id所在的段中, term_id对应的关键字
+    const string &GetTerm(uint64_t doc_id, uint32_t term_id) const
+    {
+        return segments[FindSegment(doc_id)]->GetTerm(term_id);
+    }
+
+    // 没有被删除的文档数
+    uint64_t LiveDocCount() const
+    {
+        uint64_t count = doc_count;
+        for (auto &bitmap : deletes)
+        {
+            if (bitmap != nullptr)
+            {
+                count -= bitmap->Count();
+            }
+        }
+        return count;
+    }
+
+    // 修改segments/deletes之后重新计算每个段的起始编号
+    void UpdateBases()
+    {
+        bases.resize(segments.size());
+        doc_count = 0;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            bases[i] = doc_count;
+            doc_count += segments[i]->DocCount();
+        }
+    }
+
+private:
+    size_t FindSegment(uint64_t doc_id) const
+    {
+        if (doc_id >= doc_count)
+        {
+            return segments.size();
+        }
+        return upper_bound(bases.begin(), bases.end(), doc_id) - bases.begin() - 1;
+    }
+};
+
+// 分段的索引
+// - 新文档进入一个小的内存段, 内存段满了之后就变成只读段
+// - 删除文档只在删除位图中做标记
+// - 后台线程把同一层的只读段合并成更大的段, 同时丢掉被删除的文档
+// 每次修改都生成一个新的IndexSnapshot再原子地替换, 查询不需要加锁
 class Index
 {
 private:
-    // 正排索引的数据结构用数组, 数组的下标天然是文档的ID
-    vector<DocInfo> forward_index; // 正排索引
+    shared_ptr<const IndexSnapshot> snapshot; // 只通过atomic_load/atomic_store访问
+
+    mutex write_mtx;                          // 所有修改索引的操作串行执行
+    SegmentBuilder memory_builder;            // 内存段中的文档
+    shared_ptr<const Segment> memory_segment; // 快照中的内存段, 没有时为nullptr
+    bool store_positions;                     // 新建立的段是否保存关键字在正文中的位置
+    Bm25Params bm25;                          // conf/bm25.conf, 每次BuildIndex/LoadIndex时重新读取
+    shared_ptr<const Segment> stats_base;     // 最近一次BuildIndex/LoadIndex得到的段, 内存段算BM25F时用它的统计信息
 
-    // 倒排索引一定是一个关键字和一组(个)InvertedElem对应【关键字和倒排拉链的映射关系】
-    unordered_map<string, InvertedList> inverted_index;
+    // 后台合并线程
+    thread merge_thread;
+    condition_variable merge_cond;
+    bool merge_stop;
 
 private:
-    Index() {} // 这里一定要有函数体，不能delete
+    Index() // 这里一定要有函数体，不能delete
+        : snapshot(make_shared<IndexSnapshot>()), store_positions(true), merge_stop(false)
+    {}
     Index(const Index&) = delete;
     Index& operator=(const Index&) = delete;
 
@@ -52,7 +146,10 @@ private:
     static mutex mtx;
 
 public:
-    ~Index() {}
+    ~Index()
+    {
+        StopMerger();
+    }
 
 public:
     // 创建单例模式
@@ -70,32 +167,195 @@ public:
         return instance;
     }
 
-    // 根据doc_id找到找到文档内容(获得正排)
-    DocInfo *GetForwardIndex(uint64_t doc_id)
+    // 获得当前的快照, 拿到的快照在使用期间一直有效
+    shared_ptr<const IndexSnapshot> GetSnapshot() const
+    {
+        return atomic_load(&snapshot);
+    }
+
+    // 之后建立的段是否保存关键字在正文中的位置(默认保存), 不保存时索引更小, 但摘要和短语查询要扫描正文
+    void SetStorePositions(bool positions)
     {
-        if (doc_id >= forward_index.size())
+        lock_guard<mutex> lock(write_mtx);
+        store_positions = positions;
+        if (memory_builder.DocCount() == 0)
         {
-            cerr << "doc_id out range error!" <<endl;
-            return nullptr;
+            memory_builder = NewMemoryBuilder();
         }
-        return &forward_index[doc_id];
     }
 
-    // 根据关键字string, 获得倒排拉链
-    InvertedList *GetInvertedList(const string &word)
+    // 根据去标签，格式化之后的文档，构建正排和倒排索引, 替换掉当前所有的段
+    // data/raw_html/raw.txt
+    // thread_num: 并行分词的线程数, 0表示CPU核数
+    bool BuildIndex(const string &input, int thread_num = 0) //parse处理完毕的数据交给我
     {
-        auto iter = inverted_index.find(word);
-        if (iter == inverted_index.end())
+        vector<DocInfo> docs;
+        if (!ReadDocs(input, &docs))
         {
-            cerr << word << " have no InvertedList!" << endl;
-            return nullptr;
+            return false;
         }
-        return &(iter->second);
+        return BuildIndex([&docs, thread_num](SegmentBuilder *builder) {
+            builder->AddDocs(move(docs), thread_num);
+            return true;
+            });
     }
 
-    // 根据去标签，格式化之后的文档，构建正排和倒排索引
-    // data/raw_html/raw.txt
-    bool BuildIndex(const string &input) //parse处理完毕的数据交给我
+    // 由fill向一个新的SegmentBuilder中加入所有文档(比如index_builder --html直接解析网页),
+    // 建好的段替换掉当前所有的段; fill返回false时索引不变
+    bool BuildIndex(const function<bool(SegmentBuilder *)> &fill)
+    {
+        LoadBm25Params();
+
+        SegmentBuilder builder(store_positions, bm25);
+        if (!fill(&builder))
+        {
+            return false;
+        }
+        ResetSegment(builder.Finish());
+        return true;
+    }
+
+    // mmap方式加载索引文件, 替换掉当前所有的段
+    bool LoadIndex(const string &input)
+    {
+        shared_ptr<Segment> segment = make_shared<Segment>();
+        if (!segment->Load(input))
+        {
+            return false;
+        }
+        LoadBm25Params();
+        ResetSegment(segment);
+        return true;
+    }
+
+    // 把当前所有没有被删除的文档合并成一个段写入索引文件
+    bool SaveIndex(const string &output)
+    {
+        shared_ptr<const IndexSnapshot> current = GetSnapshot();
+        if (current->SegmentCount() == 1 && current->deletes[0] == nullptr)
+        {
+            return current->segments[0]->Save(output);
+        }
+
+        vector<const Segment *> segments;
+        vector<const DeleteBitmap *> deletes;
+        for (size_t i = 0; i < current->SegmentCount(); i++)
+        {
+            segments.push_back(current->segments[i].get());
+            deletes.push_back(current->deletes[i].get());
+        }
+        vector<vector<uint32_t>> doc_maps;
+        return Segment::Merge(segments, deletes, &doc_maps)->Save(output);
+    }
+
+    // 读取和raw.txt格式相同的文件, 其中的文档加入索引(url相同的旧文档会被替换)
+    // delete_list不为空时, 其中的url(每行一个)对应的文档同时被删除; 文件不存在时当作没有要删除的文档
+    // 新文档和删除在同一个快照中生效(parser增量解析生成的update.txt和delete.txt)
+    bool UpdateIndex(const string &input, const string &delete_list = "")
+    {
+        vector<DocInfo> docs;
+        if (!ReadDocs(input, &docs))
+        {
+            return false;
+        }
+        vector<string> deleted;
+        if (!delete_list.empty())
+        {
+            ReadLines(delete_list, &deleted);
+        }
+        AddDocuments(move(docs), deleted);
+        return true;
+    }
+
+    // 加入一批文档, url相同的旧文档和deleted中的url对应的文档会被删除; 返回之后新文档就可以被查到了
+    void AddDocuments(vector<DocInfo> docs, const vector<string> &deleted = vector<string>())
+    {
+        if (docs.empty() && deleted.empty())
+        {
+            return;
+        }
+        unique_lock<mutex> lock(write_mtx);
+        shared_ptr<IndexSnapshot> next = make_shared<IndexSnapshot>(*GetSnapshot());
+
+        // 1. 删除旧文档
+        for (auto &doc : docs)
+        {
+            MarkDeleted(next.get(), doc.url);
+        }
+        for (auto &url : deleted)
+        {
+            MarkDeleted(next.get(), url);
+        }
+        if (!docs.empty())
+        {
+            // 2. 新文档进入内存段, 内存段重新生成之后替换掉快照中旧的内存段
+            memory_builder.AddDocs(move(docs));
+            shared_ptr<const Segment> segment = memory_builder.Build();
+            if (memory_segment != nullptr && !next->segments.empty() && next->segments.back() == memory_segment)
+            {
+                next->segments.back() = segment;
+            }
+            else
+            {
+                next->segments.push_back(segment);
+                next->deletes.push_back(nullptr);
+            }
+            memory_segment = segment;
+
+            // 3. 内存段满了, 以后的文档进入新的内存段, 这个段交给后台线程去合并
+            if (memory_builder.DocCount() >= MEMORY_SEGMENT_DOCS)
+            {
+                memory_builder = NewMemoryBuilder();
+                memory_segment = nullptr;
+            }
+        }
+        Publish(next);
+        lock.unlock();
+        merge_cond.notify_one();
+    }
+
+    // 根据url删除文档, 没有这个文档时返回false
+    bool DeleteDocument(const string &url)
+    {
+        lock_guard<mutex> lock(write_mtx);
+        shared_ptr<IndexSnapshot> next = make_shared<IndexSnapshot>(*GetSnapshot());
+        if (!MarkDeleted(next.get(), url))
+        {
+            return false;
+        }
+        Publish(next);
+        merge_cond.notify_one();
+        return true;
+    }
+
+    // 启动后台合并线程
+    void StartMerger()
+    {
+        lock_guard<mutex> lock(write_mtx);
+        if (merge_thread.joinable())
+        {
+            return;
+        }
+        merge_stop = false;
+        merge_thread = thread(&Index::MergeLoop, this);
+    }
+
+    void StopMerger()
+    {
+        {
+            lock_guard<mutex> lock(write_mtx);
+            merge_stop = true;
+        }
+        merge_cond.notify_one();
+        if (merge_thread.joinable())
+        {
+            merge_thread.join();
+        }
+    }
+
+private:
+    // 按行读取raw.txt格式的文件, 每行是一个文档: title\3content\3url
+    static bool ReadDocs(const string &input, vector<DocInfo> *docs)
     {
         ifstream in(input, std::ios::in | std::ios::binary);
         if (!in.is_open())
@@ -107,35 +367,42 @@ public:
         // 按照一行来读取
         // 从in当中按行来读取, 然后写入file中
         string line;
-        int count = 0; // 用于测试
         while (getline(in, line))
         {
-            // 建立正排索引
-            DocInfo *doc = BuildForwardIndex(line);
-            if (nullptr == doc)
+            DocInfo doc;
+            if (!ParseDoc(line, &doc))
             {
                 std::cerr << "build " << line << " error" << std::endl; //for deubg
                 continue;
             }
+            docs->push_back(move(doc));
+        }
+        //
+        in.close();
+        return true;
+    }
 
-            // 建立倒排索引
-            BuildInvertedIndex(*doc);
-
-            // 测试代码
-            count++;
-            if(0 == count % 50)
+    // 按行读取文件, 跳过空行; 文件不存在时返回false
+    static bool ReadLines(const string &input, vector<string> *lines)
+    {
+        ifstream in(input, std::ios::in | std::ios::binary);
+        if (!in.is_open())
+        {
+            return false;
+        }
+        string line;
+        while (getline(in, line))
+        {
+            if (!line.empty())
             {
-                logMsg(NORMAL, "当前已经建立的索引文档: %d", count);
+                lines->push_back(move(line));
             }
         }
-        //
-        in.close();
         return true;
     }
 
-private:
     // 一次构建正排索引的过程
-    DocInfo *BuildForwardIndex(const string &line)
+    static bool ParseDoc(const string &line, DocInfo *doc)
     {
         // 1. 解析line, 字符串切分
         // 把每一行line --> 3个string: title, content, url
@@ -144,94 +411,198 @@ private:
         StringUtil::Split(line, &results, sep); // 从line中切分, 把结果放到results中
         if (results.size() != 3)
         {
-            return nullptr;
+            return false;
         }
 
         // 2. 把字符串进行填充到DocIinfo中
-        DocInfo doc;
-        doc.title = results[0];     // title
-        doc.content = results[1];   // content
-        doc.url = results[2];       // url
-        doc.doc_id = forward_index.size(); // 先进行保存id, 再插入, 对应的id就是当前doc在vector中的下标!
-
-        // 3. 插入到正排索引的vector中
-        forward_index.push_back(move(doc)); // doc: html文件内容
-        return &forward_index.back(); // back()是vector中的最后一个元素(我们每次都要返回最新的)
-    }
-
-    // 一次构建倒排索引的过程
-    bool BuildInvertedIndex(const DocInfo &doc)
-    {
-        // 此时DocInfo中包含: {title, content, url, doc_id}
-        // 然后要根据【word】 --> 【倒排拉链】之间建立映射。
-
-        // 词频统计
-        struct word_cnt 
-        {
-            int title_cnt;
-            int content_cnt;
-            // 初始化
-            word_cnt()
-                : title_cnt(0), content_cnt(0)
-            {}
-        };
-        unordered_map<string, word_cnt> word_map; //用来暂存词频的映射表
-
-        // 对标题进行分词
-        vector<string> title_words;
-        JiebaUtil::CutString(doc.title, &title_words);
-        // 调试
-        // if (doc.doc_id == 1007)
-        // {
-        //     for (auto &s : title_words)
-        //     {
-        //         cout << "title: " << s << endl;
-        //     }
-        // }
-
-        // 对文档标题进行词频统计
-        for (string s : title_words)
-        {
-            boost::to_lower(s);     // 需要统一转化成为小写
-            word_map[s].title_cnt++; // 如果存在就获取，如果不存在就新建
-        }
-
-        // 对文档内容进行分词
-        vector<string> content_words;
-        JiebaUtil::CutString(doc.title, &content_words);
-        // 调试
-        // if (doc.doc_id == 1007)
-        // {
-        //     for (auto &s : content_words)
-        //     {
-        //         cout << "content: " << s << endl;
-        //     }
-        // }
-
-        // 对内容进行词频统计
-        for (string s : content_words)
-        {
-            boost::to_lower(s);   // 需要统一转化成为小写
-            word_map[s].content_cnt++;
-        }
-
-// 自定义相关性
-#define X 10
-#define Y 1
-        // 把统计好的词频设置进倒排拉链中
-        for (auto &word_pair : word_map)
-        {
-            InvertedElem item;
-            item.doc_id = doc.doc_id;
-            item.word = word_pair.first;
-            item.weight = (X * word_pair.second.title_cnt) + (Y * word_pair.second.content_cnt);
-            InvertedList &inverted_list = inverted_index[word_pair.first];
-            inverted_list.push_back(move(item));
+        doc->title = move(results[0]);     // title
+        doc->content = move(results[1]);   // content
+        doc->url = move(results[2]);       // url
+        doc->doc_id = 0; // 加入段的时候再分配
+        doc->title_len = doc->content_len = 0; // 分词的时候再统计
+        return true;
+    }
+
+    // 用一个段替换掉当前所有的段
+    void ResetSegment(shared_ptr<const Segment> segment)
+    {
+        lock_guard<mutex> lock(write_mtx);
+        shared_ptr<IndexSnapshot> next = make_shared<IndexSnapshot>();
+        next->version = GetSnapshot()->version;
+        next->segments.push_back(segment);
+        next->deletes.push_back(nullptr);
+        stats_base = segment;
+        memory_builder = NewMemoryBuilder();
+        memory_segment = nullptr;
+        Publish(next);
+    }
+
+    // 新的内存段, 调用者持有write_mtx
+    SegmentBuilder NewMemoryBuilder() const
+    {
+        return SegmentBuilder(store_positions, bm25, stats_base);
+    }
+
+    void LoadBm25Params()
+    {
+        lock_guard<mutex> lock(write_mtx);
+        bm25 = Bm25Params();
+        if (!bm25.Load(BM25_CONF_PATH))
+        {
+            logMsg(WARNING, "读取%s失败, 使用默认的BM25F参数", BM25_CONF_PATH);
         }
+    }
 
-        return true;
+    // 在next中把url对应的文档标记为删除, 调用者持有write_mtx
+    bool MarkDeleted(IndexSnapshot *next, const string &url)
+    {
+        bool found = false;
+        for (size_t i = 0; i < next->SegmentCount(); i++)
+        {
+            uint32_t doc_id = next->segments[i]->FindDoc(url);
+            if (doc_id == INVALID_DOC_ID || next->IsDeleted(i, doc_id))
+            {
+                continue;
+            }
+            // 删除位图也是快照的一部分, 只能复制一份再修改
+            shared_ptr<DeleteBitmap> bitmap = next->deletes[i] ? make_shared<DeleteBitmap>(*next->deletes[i])
+                                                               : make_shared<DeleteBitmap>();
+            bitmap->Set(doc_id);
+            next->deletes[i] = bitmap;
+            found = true;
+        }
+        return found;
+    }
+
+    // 发布新快照, 调用者持有write_mtx
+    void Publish(shared_ptr<IndexSnapshot> next)
+    {
+        next->version++;
+        next->UpdateBases();
+        atomic_store(&snapshot, shared_ptr<const IndexSnapshot>(next));
+    }
+
+    // 段所在的层: 文档数每大MERGE_FACTOR倍, 层数加1
+    static int Tier(uint64_t docs)
+    {
+        int tier = 0;
+        for (uint64_t size = MEMORY_SEGMENT_DOCS; docs > size; size *= MERGE_FACTOR)
+        {
+            tier++;
+        }
+        return tier;
+    }
+
+    // 选出需要合并的段(下标), 不需要合并时返回空
+    // 同一层的只读段达到MERGE_FACTOR个时合并它们; 一半以上的文档都被删除的段单独重写
+    vector<size_t> PickMerge(const IndexSnapshot &current)
+    {
+        vector<vector<size_t>> tiers;
+        for (size_t i = 0; i < current.SegmentCount(); i++)
+        {
+            if (current.segments[i] == memory_segment)
+            {
+                continue;
+            }
+            uint32_t docs = current.segments[i]->DocCount();
+            uint32_t deleted = current.deletes[i] ? current.deletes[i]->Count() : 0;
+            if (deleted * 2 > docs)
+            {
+                return vector<size_t>(1, i);
+            }
+            int tier = Tier(docs - deleted);
+            if ((int)tiers.size() <= tier)
+            {
+                tiers.resize(tier + 1);
+            }
+            tiers[tier].push_back(i);
+            if (tiers[tier].size() == MERGE_FACTOR)
+            {
+                return tiers[tier];
+            }
+        }
+        return vector<size_t>();
+    }
+
+    void MergeLoop()
+    {
+        unique_lock<mutex> lock(write_mtx);
+        while (!merge_stop)
+        {
+            shared_ptr<const IndexSnapshot> current = GetSnapshot();
+            vector<size_t> picked = PickMerge(*current);
+            if (picked.empty())
+            {
+                merge_cond.wait_for(lock, chrono::seconds(1));
+                continue;
+            }
+
+            // 1. 合并的时候不持有锁, 查询和更新都可以照常进行
+            vector<const Segment *> segments;
+            vector<const DeleteBitmap *> deletes;
+            for (size_t i : picked)
+            {
+                segments.push_back(current->segments[i].get());
+                deletes.push_back(current->deletes[i].get());
+            }
+            lock.unlock();
+            auto start = chrono::steady_clock::now();
+            vector<vector<uint32_t>> doc_maps;
+            shared_ptr<const Segment> merged = Segment::Merge(segments, deletes, &doc_maps);
+            lock.lock();
+
+            // 2. 合并期间索引可能被整个替换了, 这次合并的结果就不要了
+            shared_ptr<IndexSnapshot> next = make_shared<IndexSnapshot>(*GetSnapshot());
+            vector<size_t> positions;
+            for (size_t i : picked)
+            {
+                auto iter = find(next->segments.begin(), next->segments.end(), current->segments[i]);
+                if (iter == next->segments.end())
+                {
+                    break;
+                }
+                positions.push_back(iter - next->segments.begin());
+            }
+            if (positions.size() != picked.size())
+            {
+                continue;
+            }
+
+            // 3. 合并期间又被删除的文档, 在新段中也要标记为删除
+            shared_ptr<DeleteBitmap> bitmap = make_shared<DeleteBitmap>();
+            for (size_t k = 0; k < positions.size(); k++)
+            {
+                const DeleteBitmap *now = next->deletes[positions[k]].get();
+                if (now == nullptr || now == deletes[k])
+                {
+                    continue;
+                }
+                for (uint32_t doc_id = 0; doc_id < doc_maps[k].size(); doc_id++)
+                {
+                    if (doc_maps[k][doc_id] != INVALID_DOC_ID && now->Test(doc_id))
+                    {
+                        bitmap->Set(doc_maps[k][doc_id]);
+                    }
+                }
+            }
+
+            // 4. 新段放在第一个被合并的段的位置上, 其它被合并的段去掉; 文档全被删除时新段也不要了
+            sort(positions.begin(), positions.end());
+            next->segments[positions[0]] = merged;
+            next->deletes[positions[0]] = bitmap->Count() ? bitmap : nullptr;
+            size_t keep = merged->DocCount() > 0 ? 1 : 0;
+            for (size_t k = positions.size(); k-- > keep; )
+            {
+                next->segments.erase(next->segments.begin() + positions[k]);
+                next->deletes.erase(next->deletes.begin() + positions[k]);
+            }
+            Publish(next);
+            logMsg(NORMAL, "合并了%lu个段, 新段文档数: %u, 用时%.3fs, 当前段数: %lu", (unsigned long)picked.size(),
+                   merged->DocCount(), chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+                   (unsigned long)next->SegmentCount());
+        }
     }
 };
 
 Index* Index::instance = nullptr;
-mutex Index::mtx;
\ No newline at end of file
+mutex Index::mtx;
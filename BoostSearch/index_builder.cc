@@ -0,0 +1,57 @@
+#include <cstring>
+#include <boost/filesystem.hpp>
+#include "index.hpp"
+#include "index_pipeline.hpp"
+
+// 离线建立索引: 读取parser生成的raw.txt, 建立正排和倒排索引, 写成二进制索引文件
+// http_server和debug启动时直接加载这个文件, 不需要再对每个文档分词
+const string input = "data/raw_html/raw.txt";
+const string src_path = "data/input"; // --html: 直接从原始html网页建索引
+const string index_file = "data/index/index.bin";
+
+// ./index_builder [thread_num] [--no-positions] [--html]
+// 不指定线程数时使用CPU核数; --no-positions: 不保存关键字在正文中的位置
+// --html: 不读raw.txt, 在一个进程内解析data/input下的网页并建索引(解析, 分词, 建索引流水线进行)
+int main(int argc, char *argv[])
+{
+    int thread_num = 0;
+    bool positions = true;
+    bool html = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-positions") == 0)
+        {
+            positions = false;
+        }
+        else if (strcmp(argv[i], "--html") == 0)
+        {
+            html = true;
+        }
+        else
+        {
+            thread_num = atoi(argv[i]);
+        }
+    }
+
+    Index *index = Index::GetInstance();
+    index->SetStorePositions(positions);
+    bool ok = html ? index->BuildIndex([thread_num](SegmentBuilder *builder) {
+                         return IndexPipeline(src_path, thread_num).Run(builder);
+                         })
+                   : index->BuildIndex(input, thread_num);
+    if (!ok)
+    {
+        cerr << "build index error!" << endl;
+        return 1;
+    }
+    logMsg(NORMAL, "建立正排和倒排索引成功...");
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(boost::filesystem::path(index_file).parent_path(), ec);
+    if (!index->SaveIndex(index_file))
+    {
+        cerr << "save index error!" << endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "log.hpp"
+#include "bounded_queue.hpp"
+#include "html_parser.hpp"
+#include "segment.hpp"
+
+// 一个进程内直接从html网页建索引: 枚举文件 -> 解析(去标签) -> 分词 -> 加入SegmentBuilder
+// 相邻的阶段之间用有界队列连接, 每个html文件只读一次, 不经过raw.txt, 也不需要再把每一行切分一遍
+// 解析和分词是多线程的, 加入索引只有一个线程(调用Run的线程), 它按文件顺序加入文档,
+// 所以建出来的段和 parser + index_builder 建出来的完全一样, 和线程数无关
+const size_t PIPELINE_QUEUE_SIZE = 256; // 每个队列最多放多少个文档
+const size_t PIPELINE_WINDOW = 1024;    // 已经开始解析但还没有加入索引的文件数上限, 也就是重排缓冲区的大小
+
+class IndexPipeline
+{
+private:
+    // 在流水线中流动的一个文档, seq是文件在files_list中的下标
+    struct Item
+    {
+        size_t seq;
+        bool ok;      // 解析失败的文件也要往下传, 加入索引的线程才知道不用等它
+        DocInfo doc;
+        TermMap terms;
+    };
+    typedef unique_ptr<Item> ItemPtr;
+
+    string src_path;
+    int parse_threads;
+    int cut_threads;
+
+    vector<string> files_list;
+    BoundedQueue<size_t> files;   // 枚举 -> 解析
+    BoundedQueue<ItemPtr> parsed; // 解析 -> 分词
+    BoundedQueue<ItemPtr> cut;    // 分词 -> 加入索引
+
+    // 流量控制: 第seq个文件要等seq < added + PIPELINE_WINDOW才开始解析
+    // 某个文档很慢时, 后面的文档最多积压PIPELINE_WINDOW个
+    mutex window_mtx;
+    condition_variable window_cond;
+    size_t added;
+
+    atomic<uint64_t> bytes;
+
+    IndexPipeline(const IndexPipeline&) = delete;
+    IndexPipeline& operator=(const IndexPipeline&) = delete;
+
+public:
+    // thread_num: 分词的线程数, 0表示CPU核数; 去标签比分词快得多, 解析的线程数是它的1/4
+    IndexPipeline(const string &src_path, int thread_num = 0)
+        : src_path(src_path), files(PIPELINE_QUEUE_SIZE), parsed(PIPELINE_QUEUE_SIZE), cut(PIPELINE_QUEUE_SIZE),
+          added(0), bytes(0)
+    {
+        if (thread_num <= 0)
+        {
+            thread_num = max(1u, thread::hardware_concurrency());
+        }
+        cut_threads = thread_num;
+        parse_threads = max(1, thread_num / 4);
+    }
+
+    // 把src_path下的所有网页加入builder; 最后还要调用builder的Finish生成段
+    bool Run(SegmentBuilder *builder)
+    {
+        if (!HtmlParser::EnumFile(src_path, &files_list))
+        {
+            return false;
+        }
+        auto start = chrono::steady_clock::now();
+
+        vector<thread> threads;
+        threads.emplace_back([this]{ Enumerate(); });
+        atomic<int> parsing(parse_threads);
+        for (int i = 0; i < parse_threads; i++)
+        {
+            threads.emplace_back([this, &parsing]{
+                Parse();
+                if (--parsing == 0)
+                {
+                    parsed.Close();
+                }
+            });
+        }
+        atomic<int> cutting(cut_threads);
+        for (int i = 0; i < cut_threads; i++)
+        {
+            threads.emplace_back([this, builder, &cutting]{
+                Cut(*builder);
+                if (--cutting == 0)
+                {
+                    cut.Close();
+                }
+            });
+        }
+
+        size_t docs = Add(builder, start);
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double mb = bytes / (1024.0 * 1024.0);
+        logMsg(NORMAL, "流水线建立索引完成, 文件数: %lu, 文档数: %lu, 解析线程: %d, 分词线程: %d, "
+               "%.1f MB, %.2f s, %.1f MB/s, %.0f docs/s",
+               (unsigned long)files_list.size(), (unsigned long)docs, parse_threads, cut_threads,
+               mb, seconds, seconds > 0 ? mb / seconds : 0.0, seconds > 0 ? docs / seconds : 0.0);
+        return true;
+    }
+
+private:
+    // 按顺序放出文件的下标, 受PIPELINE_WINDOW限制
+    void Enumerate()
+    {
+        for (size_t seq = 0; seq < files_list.size(); seq++)
+        {
+            {
+                unique_lock<mutex> lock(window_mtx);
+                window_cond.wait(lock, [this, seq]{ return seq < added + PIPELINE_WINDOW; });
+            }
+            files.Push(seq);
+        }
+        files.Close();
+    }
+
+    void Parse()
+    {
+        size_t seq;
+        uint64_t n = 0;
+        while (files.Pop(&seq))
+        {
+            ItemPtr item(new Item());
+            item->seq = seq;
+            HtmlDoc html;
+            item->ok = HtmlParser::ParseFile(src_path, files_list[seq], &html, &n);
+            if (item->ok)
+            {
+                item->doc.title = move(html.title);
+                item->doc.content = move(html.content);
+                item->doc.url = move(html.url);
+                item->doc.doc_id = 0; // 加入段的时候再分配
+                item->doc.title_len = item->doc.content_len = 0; // 分词的时候再统计
+            }
+            parsed.Push(move(item));
+        }
+        bytes += n;
+    }
+
+    void Cut(const SegmentBuilder &builder)
+    {
+        ItemPtr item;
+        while (parsed.Pop(&item))
+        {
+            if (item->ok)
+            {
+                builder.Tokenize(&item->doc, &item->terms);
+            }
+            cut.Push(move(item));
+        }
+    }
+
+    // 在调用Run的线程中: 把分好词的文档放进重排缓冲区, 按文件顺序加入builder, 返回加入的文档数
+    size_t Add(SegmentBuilder *builder, chrono::steady_clock::time_point start)
+    {
+        vector<ItemPtr> window(PIPELINE_WINDOW);
+        size_t next = 0; // 下一个要加入的文件
+        size_t docs = 0;
+        ItemPtr item;
+        while (cut.Pop(&item))
+        {
+            size_t slot = item->seq % PIPELINE_WINDOW;
+            window[slot] = move(item);
+            size_t first = next;
+            while (window[next % PIPELINE_WINDOW] != nullptr)
+            {
+                ItemPtr &ready = window[next % PIPELINE_WINDOW];
+                if (ready->ok)
+                {
+                    builder->AppendDoc(move(ready->doc), &ready->terms);
+                    if (0 == ++docs % 500)
+                    {
+                        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                        logMsg(NORMAL, "当前已经建立的索引文档: %lu, %.0f docs/s", (unsigned long)docs,
+                               seconds > 0 ? docs / seconds : 0.0);
+                    }
+                }
+                ready.reset();
+                next++;
+            }
+            if (next != first)
+            {
+                {
+                    lock_guard<mutex> lock(window_mtx);
+                    added = next;
+                }
+                window_cond.notify_one();
+            }
+        }
+        return docs;
+    }
+};
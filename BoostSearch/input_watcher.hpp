@@ -0,0 +1,330 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <boost/filesystem.hpp>
+#include "log.hpp"
+
+// 用inotify监视一个目录树下.html文件的变化, 按防抖窗口攒成一批交给回调
+// 写完(IN_CLOSE_WRITE)或者移进来的文件算修改, 删除或者移走的算删除; 同一个文件在一批中只保留最后的状态
+// 新建或者移进来的子目录自动加入监视, 其中已有的网页算修改; 移走的子目录下的网页算删除
+// 最后一个事件之后安静了debounce_ms才交出这一批; 一直有事件时最多攒WATCH_MAX_DELAY_FACTOR个窗口
+const int WATCH_MAX_DELAY_FACTOR = 10;
+const size_t WATCH_BUFFER_SIZE = 64 * 1024;
+
+class InputWatcher
+{
+public:
+    // changed: 新增或者修改的文件, removed: 删除的文件; 都是root开头的路径, 已经排好序
+    typedef std::function<void(const std::vector<std::string> &changed, const std::vector<std::string> &removed)> Callback;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::string root;
+    int debounce_ms;
+    Callback callback;
+
+    int inotify_fd;
+    int stop_fd;
+    std::thread worker;
+    std::atomic<bool> stopping;
+
+    // 以下只在后台线程中访问
+    std::unordered_map<int, std::string> dirs; // 监视描述符 -> 目录
+    std::unordered_set<std::string> files;     // 目录树中已知的网页
+    std::map<std::string, bool> pending;       // 还没有交出去的变化: 路径 -> 是否被删除
+    Clock::time_point first_event;
+    Clock::time_point last_event;
+
+    InputWatcher(const InputWatcher&) = delete;
+    InputWatcher& operator=(const InputWatcher&) = delete;
+
+public:
+    InputWatcher(const std::string &root, int debounce_ms, Callback callback)
+        : root(root), debounce_ms(std::max(1, debounce_ms)), callback(callback),
+          inotify_fd(-1), stop_fd(-1), stopping(false)
+    {}
+
+    ~InputWatcher()
+    {
+        Stop();
+    }
+
+    // 监视整个目录树, 启动后台线程; 失败时返回false
+    bool Start()
+    {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (inotify_fd < 0 || stop_fd < 0)
+        {
+            logMsg(ERROR, "inotify初始化失败: %s", strerror(errno));
+            return false;
+        }
+        if (!AddTree(root, false))
+        {
+            return false;
+        }
+        worker = std::thread([this]{ Run(); });
+        logMsg(NORMAL, "开始监视 %s, 目录数: %lu, 网页数: %lu, 防抖窗口: %dms", root.c_str(),
+               (unsigned long)dirs.size(), (unsigned long)files.size(), debounce_ms);
+        return true;
+    }
+
+    void Stop()
+    {
+        if (worker.joinable())
+        {
+            stopping = true;
+            uint64_t one = 1;
+            ssize_t ret = write(stop_fd, &one, sizeof(one));
+            (void)ret;
+            worker.join();
+        }
+        if (inotify_fd >= 0)
+        {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+        if (stop_fd >= 0)
+        {
+            close(stop_fd);
+            stop_fd = -1;
+        }
+    }
+
+private:
+    void Run()
+    {
+        struct pollfd fds[2];
+        fds[0].fd = inotify_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_fd;
+        fds[1].events = POLLIN;
+        while (!stopping)
+        {
+            int timeout = -1;
+            if (!pending.empty())
+            {
+                Clock::time_point deadline = std::min(last_event + std::chrono::milliseconds(debounce_ms),
+                    first_event + std::chrono::milliseconds(debounce_ms * WATCH_MAX_DELAY_FACTOR));
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+                if (left <= 0)
+                {
+                    Flush();
+                    continue;
+                }
+                timeout = (int)left;
+            }
+            int n = poll(fds, 2, timeout);
+            if (n < 0 && errno != EINTR)
+            {
+                logMsg(ERROR, "poll失败: %s", strerror(errno));
+                return;
+            }
+            if (n > 0 && (fds[0].revents & POLLIN))
+            {
+                ReadEvents();
+            }
+        }
+    }
+
+    void ReadEvents()
+    {
+        alignas(struct inotify_event) char buf[WATCH_BUFFER_SIZE];
+        while (true)
+        {
+            ssize_t n = read(inotify_fd, buf, sizeof(buf));
+            if (n <= 0)
+            {
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                return; // EAGAIN: 读完了
+            }
+            for (char *p = buf; p < buf + n; )
+            {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                HandleEvent(event);
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    void HandleEvent(const struct inotify_event *event)
+    {
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+            logMsg(WARNING, "inotify事件队列溢出, 部分变化没有加入索引, 需要重新运行parser并重新加载索引");
+            return;
+        }
+        auto iter = dirs.find(event->wd);
+        if (iter == dirs.end())
+        {
+            return;
+        }
+        if (event->mask & IN_IGNORED)
+        {
+            dirs.erase(iter); // 目录被删除, 监视已经自动取消
+            return;
+        }
+        if (event->len == 0)
+        {
+            return;
+        }
+        std::string path = iter->second + "/" + event->name;
+
+        if (event->mask & IN_ISDIR)
+        {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                AddTree(path, true);
+            }
+            else if (event->mask & IN_MOVED_FROM)
+            {
+                RemoveTree(path);
+            }
+            return; // 删除的目录中的文件会先各自收到IN_DELETE
+        }
+        if (!IsHtml(path))
+        {
+            return;
+        }
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        {
+            files.insert(path);
+            Touch(path, false);
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            files.erase(path);
+            Touch(path, true);
+        }
+    }
+
+    void Touch(const std::string &path, bool removed)
+    {
+        Clock::time_point now = Clock::now();
+        if (pending.empty())
+        {
+            first_event = now;
+        }
+        last_event = now;
+        pending[path] = removed;
+    }
+
+    // 交出攒下的一批变化
+    void Flush()
+    {
+        std::vector<std::string> changed, removed;
+        for (auto &pair : pending)
+        {
+            (pair.second ? removed : changed).push_back(pair.first);
+        }
+        pending.clear();
+        try
+        {
+            callback(changed, removed);
+        }
+        catch (const std::exception &e)
+        {
+            logMsg(ERROR, "处理%s下的变化失败: %s", root.c_str(), e.what());
+        }
+    }
+
+    // 监视dir和它下面的所有子目录; report: 把其中已有的网页当作修改(新建或者移进来的目录)
+    bool AddTree(const std::string &dir, bool report)
+    {
+        if (!Watch(dir))
+        {
+            return false;
+        }
+        namespace fs = boost::filesystem;
+        boost::system::error_code ec;
+        for (fs::recursive_directory_iterator iter(dir, ec), end; !ec && iter != end; iter.increment(ec))
+        {
+            std::string path = iter->path().string();
+            if (fs::is_directory(iter->status()))
+            {
+                Watch(path);
+            }
+            else if (fs::is_regular_file(iter->status()) && IsHtml(path))
+            {
+                files.insert(path);
+                if (report)
+                {
+                    Touch(path, false);
+                }
+            }
+        }
+        if (ec)
+        {
+            logMsg(WARNING, "遍历%s失败: %s", dir.c_str(), ec.message().c_str());
+        }
+        return true;
+    }
+
+    bool Watch(const std::string &dir)
+    {
+        uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+        int wd = inotify_add_watch(inotify_fd, dir.c_str(), mask);
+        if (wd < 0)
+        {
+            logMsg(WARNING, "监视%s失败: %s", dir.c_str(), strerror(errno));
+            return false;
+        }
+        dirs[wd] = dir; // 同一个目录移动之后再加入, 描述符不变, 更新路径
+        return true;
+    }
+
+    // 目录被移走: 不再监视它和它的子目录, 其中的网页算删除
+    void RemoveTree(const std::string &dir)
+    {
+        std::string prefix = dir + "/";
+        for (auto iter = dirs.begin(); iter != dirs.end(); )
+        {
+            if (iter->second == dir || iter->second.compare(0, prefix.size(), prefix) == 0)
+            {
+                inotify_rm_watch(inotify_fd, iter->first);
+                iter = dirs.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+        for (auto iter = files.begin(); iter != files.end(); )
+        {
+            if (iter->compare(0, prefix.size(), prefix) == 0)
+            {
+                Touch(*iter, true);
+                iter = files.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    static bool IsHtml(const std::string &path)
+    {
+        static const std::string ext = ".html";
+        return path.size() > ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+    }
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+// 直接往一个string后面追加json, 不构建中间的对象树
+// JsonWriter writer(&out);
+// writer.BeginObject(); writer.Key("total"); writer.Uint(10); writer.EndObject();
+// 逗号由writer自己加; 已经转义好的字符串(比如建索引时转义好的标题)用Raw直接拷贝
+class JsonWriter
+{
+private:
+    std::string *out;
+    std::vector<bool> first; // 每一层对象/数组中是否还没有写过元素
+    bool after_key;          // 刚写完key, 下一个值前面不加逗号
+
+public:
+    // 在out原有内容的后面追加
+    explicit JsonWriter(std::string *out)
+        : out(out), after_key(false)
+    {}
+
+    void BeginObject() { BeginValue(); out->push_back('{'); first.push_back(true); }
+    void EndObject() { out->push_back('}'); first.pop_back(); }
+    void BeginArray() { BeginValue(); out->push_back('['); first.push_back(true); }
+    void EndArray() { out->push_back(']'); first.pop_back(); }
+
+    // key必须是不需要转义的字符串常量
+    void Key(const char *key)
+    {
+        BeginValue();
+        out->push_back('"');
+        out->append(key);
+        out->append("\":", 2);
+        after_key = true;
+    }
+
+    void String(const std::string &value)
+    {
+        BeginValue();
+        AppendQuoted(value.data(), value.size(), out);
+    }
+
+    // value已经是一个完整的json值(比如AppendQuoted的结果)
+    void Raw(const std::string &value)
+    {
+        BeginValue();
+        out->append(value);
+    }
+
+    void Int(int64_t value)
+    {
+        char buf[24];
+        BeginValue();
+        out->append(buf, snprintf(buf, sizeof(buf), "%lld", (long long)value));
+    }
+
+    void Uint(uint64_t value)
+    {
+        char buf[24];
+        BeginValue();
+        out->append(buf, snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value));
+    }
+
+    void Bool(bool value)
+    {
+        BeginValue();
+        out->append(value ? "true" : "false");
+    }
+
+    // 把data转义成带引号的json字符串, 追加到out后面
+    // 不需要转义的字节成段拷贝; 非ASCII的UTF-8原样输出, 不合法的UTF-8(比如截断的摘要)换成U+FFFD
+    static void AppendQuoted(const char *data, size_t size, std::string *out)
+    {
+        static const char hex[] = "0123456789abcdef";
+        const unsigned char *p = (const unsigned char *)data;
+        const unsigned char *end = p + size;
+        out->push_back('"');
+        while (p < end)
+        {
+            const unsigned char *run = p;
+            while (p < end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\')
+            {
+                p++;
+            }
+            out->append((const char *)run, p - run);
+            if (p == end)
+            {
+                break;
+            }
+
+            unsigned char c = *p;
+            if (c >= 0x80)
+            {
+                size_t len = Utf8Length(p, end);
+                if (len == 0)
+                {
+                    out->append("\\ufffd", 6);
+                    p++;
+                }
+                else
+                {
+                    out->append((const char *)p, len);
+                    p += len;
+                }
+                continue;
+            }
+            p++;
+            switch (c)
+            {
+            case '"':  out->append("\\\"", 2); break;
+            case '\\': out->append("\\\\", 2); break;
+            case '\n': out->append("\\n", 2); break;
+            case '\r': out->append("\\r", 2); break;
+            case '\t': out->append("\\t", 2); break;
+            case '\b': out->append("\\b", 2); break;
+            case '\f': out->append("\\f", 2); break;
+            default:
+                out->append("\\u00", 4);
+                out->push_back(hex[c >> 4]);
+                out->push_back(hex[c & 0xf]);
+                break;
+            }
+        }
+        out->push_back('"');
+    }
+
+    static std::string Quote(const std::string &value)
+    {
+        std::string out;
+        out.reserve(value.size() + 2);
+        AppendQuoted(value.data(), value.size(), &out);
+        return out;
+    }
+
+private:
+    void BeginValue()
+    {
+        if (after_key)
+        {
+            after_key = false;
+            return;
+        }
+        if (!first.empty())
+        {
+            if (!first.back())
+            {
+                out->push_back(',');
+            }
+            first.back() = false;
+        }
+    }
+
+    // p开头的合法UTF-8字符的字节数, 不合法时返回0
+    static size_t Utf8Length(const unsigned char *p, const unsigned char *end)
+    {
+        size_t len;
+        uint32_t min;
+        if ((p[0] & 0xe0) == 0xc0) { len = 2; min = 0x80; }
+        else if ((p[0] & 0xf0) == 0xe0) { len = 3; min = 0x800; }
+        else if ((p[0] & 0xf8) == 0xf0) { len = 4; min = 0x10000; }
+        else return 0;
+        if ((size_t)(end - p) < len)
+        {
+            return 0;
+        }
+        uint32_t cp = p[0] & (0x7f >> len);
+        for (size_t i = 1; i < len; i++)
+        {
+            if ((p[i] & 0xc0) != 0x80)
+            {
+                return 0;
+            }
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+        {
+            return 0;
+        }
+        return len;
+    }
+};
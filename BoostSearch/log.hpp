@@ -2,8 +2,15 @@
 
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
 #include <cstdarg>
+#include <cstdlib>
 #include <chrono>
 #include <ctime>
 #include <unistd.h> // getpid
@@ -15,6 +22,11 @@
 #define ERROR 3
 #define FATAL 4
 
+// 编译时过滤: 低于LOG_MIN_LEVEL的logMsg会被编译器整个去掉, 比如 -DLOG_MIN_LEVEL=WARNING
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL DEBUG
+#endif
+
 inline const char* to_levelstr(int level)
 {
     switch (level)
@@ -28,48 +40,285 @@ inline const char* to_levelstr(int level)
     }
 }
 
-// 可选：GCC/Clang 下启用 printf 风格格式检查
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((format(printf, 2, 3)))
-#endif
-inline void logMsg(int level, const char* format, ...)  // 可变参数列表
+// 异步日志
+// 调用logMsg的线程只把格式化好的消息写进自己的环形缓冲区(单生产者单消费者, 无锁), 不碰stdout
+// 后台线程把所有线程的缓冲区取空, 加上前缀 [等级] [YYYY-MM-DD HH:MM:SS] [pid: N] 之后批量写出
+// 时间字符串每秒只格式化一次; 缓冲区满了就丢弃这条日志并计数, 不会阻塞查询线程
+const size_t LOG_RECORD_SIZE = 256;  // 一条日志的大小(包括头部), 消息超长时截断
+const size_t LOG_RING_SIZE = 256;    // 每个线程的缓冲区能放多少条, 必须是2的幂
+const size_t LOG_MAX_RINGS = 1024;   // 同时写日志的线程更多时, 多出来的线程同步输出
+
+class AsyncLogger
 {
-    // [等级] [YYYY-MM-DD HH:MM:SS] [pid: N] message
+private:
+    struct Record
+    {
+        int level;
+        int64_t time;   // 秒
+        char text[LOG_RECORD_SIZE - sizeof(int) - sizeof(int64_t)];
+    };
+
+    // 一个线程的环形缓冲区; 线程退出之后缓冲区留给新线程使用
+    struct Ring
+    {
+        std::atomic<uint64_t> head; // 下一个要写的位置, 只有生产者改
+        std::atomic<uint64_t> tail; // 下一个要读的位置, 只有后台线程改
+        std::atomic<bool> owned;
+        Record records[LOG_RING_SIZE];
+
+        Ring()
+            : head(0), tail(0), owned(true)
+        {}
+    };
+
+    // 线程退出时交还缓冲区
+    struct RingHandle
+    {
+        Ring *ring;
+        RingHandle() : ring(nullptr) {}
+        ~RingHandle()
+        {
+            if (ring != nullptr)
+            {
+                ring->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::mutex mtx; // 保护rings, 只在线程第一次写日志时使用
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::atomic<size_t> ring_count;
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> stopped;
+    std::thread writer;
+    int pid;
+    int64_t cached_second;
+    char cached_time[20]; // "YYYY-MM-DD HH:MM:SS"
+
+    AsyncLogger()
+        : ring_count(0), dropped(0), stopped(false), pid(getpid()), cached_second(-1)
+    {
+        rings.reserve(LOG_MAX_RINGS);
+        cached_time[0] = '\0';
+        writer = std::thread([this]{ Run(); });
+        atexit([]{ Instance().Stop(); });
+    }
+
+public:
+    // 不析构: 其它静态对象的析构函数里也可能写日志
+    static AsyncLogger &Instance()
+    {
+        static AsyncLogger *logger = new AsyncLogger();
+        return *logger;
+    }
+
+    void Write(int level, const char *format, va_list arg)
+    {
+        if (stopped.load(std::memory_order_acquire))
+        {
+            WriteSync(level, format, arg);
+            return;
+        }
+        Ring *ring = Local();
+        if (ring == nullptr)
+        {
+            WriteSync(level, format, arg);
+            return;
+        }
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) == LOG_RING_SIZE)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record &record = ring->records[head & (LOG_RING_SIZE - 1)];
+        record.level = level;
+        record.time = (int64_t)time(nullptr);
+        vsnprintf(record.text, sizeof(record.text), format, arg);
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    // 等到调用之前写的日志都已经输出
+    void Flush()
+    {
+        while (!stopped.load(std::memory_order_acquire) && Pending())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // 进程退出时: 输出剩下的日志, 之后的日志同步输出
+    void Stop()
+    {
+        if (stopped.exchange(true))
+        {
+            return;
+        }
+        writer.join();
+        Drain();
+        fflush(stdout);
+        fflush(stderr);
+    }
 
-    // 获取当前时间（到秒）
-    auto now   = std::chrono::system_clock::now();
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
+private:
+    Ring *Local()
+    {
+        static thread_local RingHandle handle;
+        if (handle.ring != nullptr)
+        {
+            return handle.ring;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        // 优先使用已经退出的线程留下的, 已经取空的缓冲区
+        for (auto &ring : rings)
+        {
+            bool owned = false;
+            if (!ring->owned.load(std::memory_order_acquire)
+                && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_acquire)
+                && ring->owned.compare_exchange_strong(owned, true))
+            {
+                handle.ring = ring.get();
+                return handle.ring;
+            }
+        }
+        if (rings.size() == rings.capacity())
+        {
+            return nullptr; // 后台线程不加锁地读rings, 不能让它重新分配
+        }
+        rings.emplace_back(new Ring());
+        handle.ring = rings.back().get();
+        ring_count.store(rings.size(), std::memory_order_release);
+        return handle.ring;
+    }
 
-    struct tm local_time;
-    localtime_r(&now_c, &local_time);
+    bool Pending() const
+    {
+        size_t n = ring_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (rings[i]->head.load(std::memory_order_acquire) != rings[i]->tail.load(std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
 
-    char time_str[20]; // "YYYY-MM-DD HH:MM:SS"
-    std::snprintf(time_str, sizeof(time_str),
-                  "%04d-%02d-%02d %02d:%02d:%02d",
-                  1900 + local_time.tm_year,
-                  1 + local_time.tm_mon,
-                  local_time.tm_mday,
-                  local_time.tm_hour,
-                  local_time.tm_min,
-                  local_time.tm_sec);
+    // 后台线程: 没有日志时逐渐延长等待时间, 最多等10ms
+    void Run()
+    {
+        int idle = 0;
+        while (!stopped.load(std::memory_order_acquire))
+        {
+            if (Drain())
+            {
+                idle = 0;
+                continue;
+            }
+            idle = idle < 10 ? idle + 1 : 10;
+            std::this_thread::sleep_for(std::chrono::milliseconds(idle));
+        }
+    }
 
-    constexpr size_t NUM = 1024;
+    // 取空所有缓冲区, 返回是否输出了日志
+    bool Drain()
+    {
+        std::string out, err;
+        size_t n = ring_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; i++)
+        {
+            Ring &ring = *rings[i];
+            uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+            uint64_t head = ring.head.load(std::memory_order_acquire);
+            for (; tail != head; tail++)
+            {
+                const Record &record = ring.records[tail & (LOG_RING_SIZE - 1)];
+                Format(record.level, record.time, record.text, record.level >= WARNING ? &err : &out);
+            }
+            ring.tail.store(tail, std::memory_order_release);
+        }
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost > 0)
+        {
+            char text[64];
+            snprintf(text, sizeof(text), "日志缓冲区满, 丢弃了%lu条日志", (unsigned long)lost);
+            Format(WARNING, (int64_t)time(nullptr), text, &err);
+        }
+        // 级别区分输出位置: WARNING 及以上走 stderr
+        if (!out.empty())
+        {
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+        }
+        if (!err.empty())
+        {
+            fwrite(err.data(), 1, err.size(), stderr);
+            fflush(stderr);
+        }
+        return !out.empty() || !err.empty();
+    }
+
+    // 只有后台线程(或者它停止之后的Stop)调用, 时间字符串每秒格式化一次
+    void Format(int level, int64_t second, const char *text, std::string *out)
+    {
+        if (second != cached_second)
+        {
+            FormatTime(second, cached_time);
+            cached_second = second;
+        }
+        FormatLine(level, cached_time, pid, text, out);
+    }
 
-    char logprefix[NUM];
-    std::snprintf(logprefix, sizeof(logprefix),
-                  "[%s] [%s] [pid: %d] ",
-                  to_levelstr(level), time_str, getpid());
+    // [等级] [YYYY-MM-DD HH:MM:SS] [pid: N] message
+    static void FormatLine(int level, const char *time_str, int pid, const char *text, std::string *out)
+    {
+        char prefix[64];
+        int n = snprintf(prefix, sizeof(prefix), "[%s] [%s] [pid: %d] ", to_levelstr(level), time_str, pid);
+        out->append(prefix, n);
+        out->append(text);
+        out->push_back('\n');
+    }
 
-    char logcontent[NUM];
+    static void FormatTime(int64_t second, char *time_str)
+    {
+        time_t t = (time_t)second;
+        struct tm local_time;
+        localtime_r(&t, &local_time);
+        strftime(time_str, 20, "%Y-%m-%d %H:%M:%S", &local_time);
+    }
+
+    // 后台线程已经停止, 或者缓冲区已经用完了: 直接输出
+    void WriteSync(int level, const char *format, va_list arg)
+    {
+        char text[sizeof(((Record *)nullptr)->text)];
+        vsnprintf(text, sizeof(text), format, arg);
+        char time_str[20];
+        FormatTime((int64_t)time(nullptr), time_str);
+        std::string line;
+        FormatLine(level, time_str, pid, text, &line);
+        FILE *file = level >= WARNING ? stderr : stdout;
+        fwrite(line.data(), 1, line.size(), file); // 一次fwrite, 多个线程的日志不会交错
+        fflush(file);
+    }
+};
+
+// 可选：GCC/Clang 下启用 printf 风格格式检查
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((format(printf, 2, 3)))
+#endif
+inline void logWrite(int level, const char* format, ...)  // 可变参数列表
+{
     va_list arg;
     va_start(arg, format);
-    std::vsnprintf(logcontent, sizeof(logcontent), format, arg);
+    AsyncLogger::Instance().Write(level, format, arg);
     va_end(arg);  // ★ 必须有
-
-    // 级别区分输出位置（可选：WARNING 及以上走 stderr）
-    if (level >= WARNING) {
-        std::cerr << logprefix << logcontent << std::endl;
-    } else {
-        std::cout << logprefix << logcontent << std::endl;
+    // FATAL之后进程通常马上就退出了, 等它输出
+    if (level >= FATAL)
+    {
+        AsyncLogger::Instance().Flush();
     }
 }
+
+// 用法和原来的函数一样: logMsg(NORMAL, "格式 %s", ...)
+#define logMsg(level, ...) \
+    do { if ((level) >= LOG_MIN_LEVEL) logWrite((level), __VA_ARGS__); } while (0)
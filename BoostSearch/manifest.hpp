@@ -0,0 +1,117 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// parser上次运行时看到的每个网页: 大小, 修改时间, 内容的hash
+// 下次运行时大小和修改时间都没变的文件直接认为没有变化, 不用再读; 变了的文件读出来比较hash
+struct ManifestEntry
+{
+    uint64_t size;
+    int64_t mtime;  // 纳秒
+    uint64_t hash;  // StringUtil::Hash
+
+    ManifestEntry()
+        : size(0), mtime(0), hash(0)
+    {}
+};
+
+// 清单文件每行一个网页: hash(16进制)\tsize\tmtime\t路径
+class Manifest
+{
+private:
+    std::unordered_map<std::string, ManifestEntry> entries; // 路径 -> 上次看到的状态
+
+public:
+    bool Load(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.is_open())
+        {
+            return false;
+        }
+        entries.clear();
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            ManifestEntry entry;
+            std::string file;
+            if (!(fields >> std::hex >> entry.hash >> std::dec >> entry.size >> entry.mtime)
+                || fields.get() != '\t' || !std::getline(fields, file) || file.empty())
+            {
+                std::cerr << "manifest " << path << " 格式错误: " << line << std::endl;
+                entries.clear();
+                return false;
+            }
+            entries[file] = entry;
+        }
+        return true;
+    }
+
+    // 先写临时文件再rename, 写到一半失败时旧的清单不受影响
+    bool Save(const std::string &path) const
+    {
+        std::string tmp = path + ".tmp";
+        FILE *out = fopen(tmp.c_str(), "wb");
+        if (out == nullptr)
+        {
+            std::cerr << "open " << tmp << " failed!" << std::endl;
+            return false;
+        }
+        // 按路径排序, 清单的内容只取决于文件
+        std::vector<const std::string *> files;
+        for (auto &pair : entries)
+        {
+            files.push_back(&pair.first);
+        }
+        std::sort(files.begin(), files.end(), [](const std::string *a, const std::string *b) { return *a < *b; });
+        for (auto file : files)
+        {
+            const ManifestEntry &entry = entries.at(*file);
+            fprintf(out, "%016llx\t%llu\t%lld\t%s\n", (unsigned long long)entry.hash,
+                    (unsigned long long)entry.size, (long long)entry.mtime, file->c_str());
+        }
+        bool ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+        ok = fclose(out) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "write " << path << " failed!" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const ManifestEntry *Find(const std::string &file) const
+    {
+        auto iter = entries.find(file);
+        return iter == entries.end() ? nullptr : &iter->second;
+    }
+
+    void Set(const std::string &file, const ManifestEntry &entry) { entries[file] = entry; }
+    void Erase(const std::string &file) { entries.erase(file); }
+    size_t Size() const { return entries.size(); }
+    const std::unordered_map<std::string, ManifestEntry> &Entries() const { return entries; }
+
+    // 取文件的大小和修改时间(hash不变)
+    static bool Stat(const std::string &file, ManifestEntry *entry)
+    {
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        entry->size = st.st_size;
+        entry->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// 查询各阶段的耗时统计
+// 每个线程有自己的一组直方图, 只有这个线程写, 记录时不加锁也没有竞争; 读的时候把所有线程的直方图加起来
+// 直方图是HDR风格的对数分桶: 小于16ns的每ns一个桶, 之后每个2的幂次区间再平分成8个桶, 相对误差不超过1/8
+
+// 查询的阶段
+enum SearchStage
+{
+    STAGE_SEGMENT = 0, // 分词
+    STAGE_CACHE,       // 查缓存
+    STAGE_PHRASE,      // 短语匹配
+    STAGE_LOOKUP,      // 查词表, 打开拉链
+    STAGE_MERGE,       // 合并拉链, 求top-k
+    STAGE_SORT,        // 排序
+    STAGE_SNIPPET,     // 解压正文, 生成摘要
+    STAGE_JSON,        // 序列化
+    STAGE_TOTAL,       // 整个查询
+    STAGE_COUNT
+};
+
+inline const char *StageName(int stage)
+{
+    static const char *names[STAGE_COUNT] = {
+        "segment", "cache", "phrase", "lookup", "merge", "sort", "snippet", "json", "total"
+    };
+    return names[stage];
+}
+
+inline uint64_t NowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 一次查询中各阶段的耗时, 同一个阶段可以分几次累加(比如每个段的合并)
+class StageTimer
+{
+private:
+    uint64_t begin;
+    uint64_t last;
+    uint64_t elapsed[STAGE_COUNT];
+    bool used[STAGE_COUNT];
+
+public:
+    StageTimer()
+        : begin(NowNanos()), last(begin), elapsed(), used()
+    {}
+
+    // 从上一次Lap(或者开始)到现在的时间算在stage上
+    void Lap(SearchStage stage)
+    {
+        uint64_t now = NowNanos();
+        elapsed[stage] += now - last;
+        used[stage] = true;
+        last = now;
+    }
+
+    void Finish()
+    {
+        elapsed[STAGE_TOTAL] = NowNanos() - begin;
+        used[STAGE_TOTAL] = true;
+    }
+
+    bool Used(int stage) const { return used[stage]; }
+    uint64_t Elapsed(int stage) const { return elapsed[stage]; }
+};
+
+const int HISTOGRAM_SUB_BITS = 3;
+const int HISTOGRAM_LINEAR = 1 << (HISTOGRAM_SUB_BITS + 1); // 小于它的值每个一个桶
+const int HISTOGRAM_BUCKETS = HISTOGRAM_LINEAR + (64 - HISTOGRAM_SUB_BITS - 1) * (1 << HISTOGRAM_SUB_BITS);
+
+// 只有一个线程写的直方图, 其它线程可以随时读(读到的可能比最新的少几个)
+class LatencyHistogram
+{
+private:
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+public:
+    LatencyHistogram()
+        : count(0), sum(0)
+    {
+        for (auto &b : buckets)
+        {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Record(uint64_t value)
+    {
+        Increase(&buckets[BucketOf(value)], 1);
+        Increase(&count, 1);
+        Increase(&sum, value);
+    }
+
+    // 把这个直方图加到out(每个桶的个数)上
+    void AddTo(std::vector<uint64_t> *out, uint64_t *total_count, uint64_t *total_sum) const
+    {
+        out->resize(HISTOGRAM_BUCKETS, 0);
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            (*out)[i] += buckets[i].load(std::memory_order_relaxed);
+        }
+        *total_count += count.load(std::memory_order_relaxed);
+        *total_sum += sum.load(std::memory_order_relaxed);
+    }
+
+    static int BucketOf(uint64_t value)
+    {
+        if (value < (uint64_t)HISTOGRAM_LINEAR)
+        {
+            return (int)value;
+        }
+        int exp = 63 - __builtin_clzll(value); // >= HISTOGRAM_SUB_BITS + 1
+        int sub = (int)((value >> (exp - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+        return HISTOGRAM_LINEAR + ((exp - HISTOGRAM_SUB_BITS - 1) << HISTOGRAM_SUB_BITS) + sub;
+    }
+
+    // 桶中最大的值
+    static uint64_t BucketMax(int bucket)
+    {
+        if (bucket < HISTOGRAM_LINEAR)
+        {
+            return (uint64_t)bucket;
+        }
+        int exp = ((bucket - HISTOGRAM_LINEAR) >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS + 1;
+        uint64_t sub = (uint64_t)((bucket - HISTOGRAM_LINEAR) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+        uint64_t low = ((uint64_t)1 << exp) + (sub << (exp - HISTOGRAM_SUB_BITS));
+        return low + ((uint64_t)1 << (exp - HISTOGRAM_SUB_BITS)) - 1;
+    }
+
+    // buckets中第q分位的值(所在桶的上界)
+    static uint64_t Quantile(const std::vector<uint64_t> &buckets, uint64_t count, double q)
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * count);
+        if (rank >= count)
+        {
+            rank = count - 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if (seen > rank)
+            {
+                return BucketMax((int)i);
+            }
+        }
+        return BucketMax((int)buckets.size() - 1);
+    }
+
+private:
+    // 只有一个线程写, 不需要原子的加法
+    static void Increase(std::atomic<uint64_t> *v, uint64_t delta)
+    {
+        v->store(v->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+};
+
+// 最近几秒的每秒次数
+const int RATE_WINDOW = 8;
+
+class RateCounter
+{
+private:
+    std::atomic<int64_t> seconds[RATE_WINDOW];
+    std::atomic<uint64_t> counts[RATE_WINDOW];
+
+public:
+    RateCounter()
+    {
+        for (int i = 0; i < RATE_WINDOW; i++)
+        {
+            seconds[i].store(-1);
+            counts[i].store(0);
+        }
+    }
+
+    void Add()
+    {
+        int64_t now = NowSeconds();
+        int slot = (int)(now % RATE_WINDOW);
+        int64_t old = seconds[slot].load();
+        // 新的一秒第一次用这个槽: 抢到的线程把计数清零, 有极少的计数会算到上一秒里, 可以接受
+        if (old != now && seconds[slot].compare_exchange_strong(old, now))
+        {
+            counts[slot].store(0);
+        }
+        counts[slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 最近window个完整的秒的平均每秒次数
+    double Rate(int window = RATE_WINDOW - 2) const
+    {
+        int64_t now = NowSeconds();
+        uint64_t total = 0;
+        for (int64_t s = now - window; s < now; s++)
+        {
+            int slot = (int)(s % RATE_WINDOW);
+            if (seconds[slot].load() == s)
+            {
+                total += counts[slot].load(std::memory_order_relaxed);
+            }
+        }
+        return (double)total / window;
+    }
+
+private:
+    static int64_t NowSeconds()
+    {
+        return (int64_t)(NowNanos() / 1000000000ULL);
+    }
+};
+
+// 所有线程的查询统计
+class SearchMetrics
+{
+private:
+    struct ThreadStats
+    {
+        LatencyHistogram stages[STAGE_COUNT];
+    };
+
+    std::mutex mtx; // 保护threads, 只在线程第一次记录和读取时使用
+    std::vector<std::unique_ptr<ThreadStats>> threads;
+    std::atomic<uint64_t> queries;
+    RateCounter rate;
+
+    SearchMetrics(const SearchMetrics&) = delete;
+    SearchMetrics& operator=(const SearchMetrics&) = delete;
+
+public:
+    SearchMetrics()
+        : queries(0)
+    {}
+
+    // 记录一次查询
+    void Record(const StageTimer &timer)
+    {
+        ThreadStats *stats = Local();
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            if (timer.Used(i))
+            {
+                stats->stages[i].Record(timer.Elapsed(i));
+            }
+        }
+        queries.fetch_add(1, std::memory_order_relaxed);
+        rate.Add();
+    }
+
+    uint64_t Queries() const { return queries.load(std::memory_order_relaxed); }
+    double Qps() const { return rate.Rate(); }
+
+    // 把所有线程的stage直方图加起来
+    void Collect(int stage, std::vector<uint64_t> *buckets, uint64_t *count, uint64_t *sum)
+    {
+        buckets->assign(HISTOGRAM_BUCKETS, 0);
+        *count = 0;
+        *sum = 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto &stats : threads)
+        {
+            stats->stages[stage].AddTo(buckets, count, sum);
+        }
+    }
+
+    // Prometheus文本格式的各阶段耗时(秒), 每个阶段是一个summary: p50/p99/p999, 总和, 次数
+    void WritePrometheus(std::string *out)
+    {
+        char line[256];
+        out->append("# HELP boost_search_stage_seconds Latency of each stage of a search.\n");
+        out->append("# TYPE boost_search_stage_seconds summary\n");
+        static const double quantiles[] = {0.5, 0.99, 0.999};
+        std::vector<uint64_t> buckets;
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+        {
+            uint64_t count = 0, sum = 0;
+            Collect(stage, &buckets, &count, &sum);
+            for (double q : quantiles)
+            {
+                snprintf(line, sizeof(line), "boost_search_stage_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                         StageName(stage), q, LatencyHistogram::Quantile(buckets, count, q) / 1e9);
+                out->append(line);
+            }
+            snprintf(line, sizeof(line), "boost_search_stage_seconds_sum{stage=\"%s\"} %.9f\n", StageName(stage), sum / 1e9);
+            out->append(line);
+            snprintf(line, sizeof(line), "boost_search_stage_seconds_count{stage=\"%s\"} %lu\n",
+                     StageName(stage), (unsigned long)count);
+            out->append(line);
+        }
+        out->append("# HELP boost_search_queries_total Number of searches.\n");
+        out->append("# TYPE boost_search_queries_total counter\n");
+        snprintf(line, sizeof(line), "boost_search_queries_total %lu\n", (unsigned long)Queries());
+        out->append(line);
+        out->append("# HELP boost_search_qps Searches per second over the last few seconds.\n");
+        out->append("# TYPE boost_search_qps gauge\n");
+        snprintf(line, sizeof(line), "boost_search_qps %.2f\n", Qps());
+        out->append(line);
+    }
+
+private:
+    // 当前线程的直方图, 第一次使用时注册
+    ThreadStats *Local()
+    {
+        static thread_local SearchMetrics *owner = nullptr;
+        static thread_local ThreadStats *local = nullptr;
+        if (owner != this)
+        {
+            std::unique_ptr<ThreadStats> stats(new ThreadStats());
+            local = stats.get();
+            std::lock_guard<std::mutex> lock(mtx);
+            threads.push_back(std::move(stats));
+            owner = this;
+        }
+        return local;
+    }
+};
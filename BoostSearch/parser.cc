@@ -1,9 +1,18 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <boost/filesystem.hpp>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
 #include "log.hpp"
-#include "util.hpp"
+#include "html_parser.hpp"
+#include "manifest.hpp"
 
 using std::cout;
 using std::endl;
@@ -14,14 +23,13 @@ using std::vector;
 // 是一个目录, 该目录下面放的是所有的html网页
 const string src_path = "data/input";          // 原始html网页的路径
 const string output = "data/raw_html/raw.txt";    // 去标签后存放的文件
+const string manifest_file = "data/raw_html/manifest.txt"; // 上次解析时每个网页的大小, 修改时间和hash
+const string update_file = "data/raw_html/update.txt";     // 增量解析: 新增和修改的文档, 格式和raw.txt相同
+const string delete_file = "data/raw_html/delete.txt";     // 增量解析: 删除的文档的url, 每行一个
+const size_t PARSE_BATCH = 16;                    // 并行解析时每个线程一次领取的文件数
 
-//
-typedef struct DocInfo
-{
-    string title;      //文档的标题
-    string content;    //文档内容
-    string url;        //该文档在官网中的url
-}DocInfo_t;
+// 解析出来的一个文档: 标题, 正文, url
+typedef HtmlDoc DocInfo_t;
 
 /*
 每个方块代表一个结构体对象（DocInfo_t）。
@@ -48,160 +56,142 @@ results（std::vector<DocInfo_t>）
 - &: 输入输出
 */
 
-bool EnumFile(const string &src_path, vector<string> *files_list);
-bool ParseHtml(const vector<string> &files_list, vector<DocInfo_t> *results);
-bool SaveHtml(const vector<DocInfo_t> &results, const string &output);
-
-int main()
+bool ParseHtml(const vector<string> &files_list, vector<DocInfo_t> *results, vector<char> *parsed,
+               vector<uint64_t> *hashes, int thread_num);
+bool LoadLines(const string &input, std::unordered_map<string, string> *lines);
+bool SaveHtml(const vector<string> &files_list, const vector<int> &fresh, const vector<DocInfo_t> &results,
+              const vector<char> &parsed, const std::unordered_map<string, string> &old_lines, const string &output);
+bool SaveDelta(const vector<DocInfo_t> &updates, const vector<string> &deletes);
+
+// ./parser [thread_num] [--full]
+// 不指定线程数时使用CPU核数, 1表示单线程; 不管几个线程, 输出的raw.txt都一样
+// 第一次运行(或者--full)时解析所有网页; 之后只解析大小或修改时间变了的网页, 其它文档从上次的raw.txt中拷贝,
+// 同时生成update.txt(新增和修改的文档)和delete.txt(删除的文档), /admin/update把它们应用到正在运行的索引
+int main(int argc, char *argv[])
 {
+    int thread_num = 0;
+    bool full = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--full") == 0)
+        {
+            full = true;
+        }
+        else
+        {
+            thread_num = atoi(argv[i]);
+        }
+    }
     vector<string> files_list; // 存储所有的html文件名
 
     //第一步: 递归式的把每个html文件名(带路径), 保存到file_list数组中, 方便后期进行一个一个的文件进行读取
-    if (!EnumFile(src_path, &files_list))
+    if (!HtmlParser::EnumFile(src_path, &files_list))
     {
         cerr << "enum file name error!" << endl;
         return 1;
     }
 
-    //第二步: 按照files_list读取每个文件的内容，并进行解析
-    vector<DocInfo_t> results;
-    if (!ParseHtml(files_list, &results))
+    //第二步: 和上次的清单比较, 大小和修改时间都没变的文件不用再读
+    Manifest old_manifest;
+    std::unordered_map<string, string> old_lines; // url -> 上次raw.txt中的那一行
+    bool incremental = !full && old_manifest.Load(manifest_file) && LoadLines(output, &old_lines);
+    Manifest manifest;
+    vector<ManifestEntry> entries(files_list.size());
+    vector<int> fresh(files_list.size(), -1); // 第i个文件在这次解析的文件中的下标, -1表示没有重新解析
+    vector<string> todo;
+    for (size_t i = 0; i < files_list.size(); i++)
     {
-        cerr << "parse html error!" << endl;
-        return 2;
-    }
-
-    //第三步: 把解析完毕的各个文件内容, 写入到output中, 并按照\3作为每个文档的分割符
-    if (!SaveHtml(results, output))
-    {
-        cerr << "sava html error" << endl;
-        return 3;
+        Manifest::Stat(files_list[i], &entries[i]);
+        const ManifestEntry *prev = incremental ? old_manifest.Find(files_list[i]) : nullptr;
+        if (prev != nullptr && prev->size == entries[i].size && prev->mtime == entries[i].mtime)
+        {
+            entries[i].hash = prev->hash;
+            continue;
+        }
+        fresh[i] = (int)todo.size();
+        todo.push_back(files_list[i]);
     }
 
-    return 0;
-}
-  
-// 使用boost库中filesystem模块的功能, 来对文件进行操作
-
-// 使用boost库中的函数来枚举文件名为【.html】的文件, 并保存到【files_list】数组中
-bool EnumFile(const string &src_path, vector<string> *files_list) 
-{
-    namespace fs = boost::filesystem;
-    fs::path root_path(src_path);
-
-    // 1.判断路径是否存在, 不存在, 就没有必要再往后走了
-    if (!fs::exists(root_path))
+    //第三步: 读取需要解析的文件的内容，并进行解析
+    vector<DocInfo_t> results;
+    vector<char> parsed;
+    vector<uint64_t> hashes;
+    if (!ParseHtml(todo, &results, &parsed, &hashes, thread_num))
     {
-        cerr << src_path << " not exists!" << endl;
-        return false;
+        cerr << "parse html error!" << endl;
+        return 2;
     }
 
-    // 2. 文件存在, 对文件进行递归遍历
-    fs::recursive_directory_iterator end; //定义一个空的迭代器，用来进行判断递归结束
-    for (fs::recursive_directory_iterator iter(root_path); iter != end; iter++)
+    //第四步: 内容真的变了的文件进入update.txt, 清单中有但是已经不存在(或者解析不出来了)的进入delete.txt
+    vector<DocInfo_t> updates;
+    vector<string> deletes;
+    std::unordered_set<string> present(files_list.begin(), files_list.end());
+    for (size_t i = 0; i < files_list.size(); i++)
     {
-        // 判断文件是否是普通文件，html都是普通文件, 诸如: .jpg / .png 等等这种就不行
-        if (!fs::is_regular_file(*iter)) 
+        if (fresh[i] < 0)
         {
-            continue; // 如果不是普通文件, 那么就跳过, 继续遍历
+            manifest.Set(files_list[i], entries[i]);
+            continue;
         }
-
-        // 如果是普通文件, 那么需要判断该文件后缀是否以【.html】结尾的
-        if (iter->path().extension() != ".html") 
+        int k = fresh[i];
+        entries[i].hash = hashes[k];
+        manifest.Set(files_list[i], entries[i]);
+        const ManifestEntry *prev = incremental ? old_manifest.Find(files_list[i]) : nullptr;
+        if (!incremental || (prev != nullptr && prev->hash == hashes[k]))
         {
-            continue;
+            continue; // 只是修改时间变了
+        }
+        if (parsed[k])
+        {
+            updates.push_back(results[k]); // url相同的旧文档会被替换
+        }
+        else if (prev != nullptr)
+        {
+            string url;
+            HtmlParser::ParseUrl(src_path, files_list[i], &url);
+            deletes.push_back(url);
         }
-
-        // 走到这里, 当前的路径一定是一个合法的, 以【.html】结束的普通网页文件
-        //logMsg(DEBUG, "%s", iter->path().string().c_str()); // 测试
-        files_list->push_back(iter->path().string()); //将所有带路径的html保存在files_list,方便后续进行文本分析
     }
-    return true;
-}
-
-// <title>HelloWorld</title>
-static bool ParseTitle(const string &file, string *title)
-{
-    // <title>HelloWorld</title>
-    // 此时 begin 指向 <title> 中的 <
-    size_t begin = file.find("<title>");
-    if (begin == string::npos)
+    if (incremental)
     {
-        return false;
+        for (auto &pair : old_manifest.Entries())
+        {
+            if (present.count(pair.first) == 0)
+            {
+                string url;
+                HtmlParser::ParseUrl(src_path, pair.first, &url);
+                deletes.push_back(url);
+            }
+        }
+        std::sort(deletes.begin(), deletes.end());
     }
 
-    // <title>HelloWorld</title>
-    // 此时 end 指向 </title> 中的 <
-    size_t end = file.find("</title>");
-    if (end == string::npos)
+    //第五步: 把解析完毕的各个文件内容, 写入到output中, 并按照\3作为每个文档的分割符
+    if (!SaveHtml(files_list, fresh, results, parsed, old_lines, output))
     {
-        return false;
+        cerr << "sava html error" << endl;
+        return 3;
     }
-
-    // <title>HelloWorld</title>
-    // 此时 begin 指向 H
-    begin += string("<title>").size();
-
-    if (begin > end) 
+    if (incremental && !SaveDelta(updates, deletes))
     {
-        return false;
+        cerr << "save delta error" << endl;
+        return 3;
     }
-
-    // 此时就提取出了HelloWorld
-    *title = file.substr(begin, end - begin);
-
-    return true;
-}
-
-//
-static bool ParseContent(const string &file, string *content)
-{
-    // 去标签, 基于一个简易的状态机
-    enum status
+    // 最后才更新清单: 前面失败时下次还会重新解析这些文件
+    if (!manifest.Save(manifest_file))
     {
-        LABLE,
-        CONTENT
-    };
-
-    enum status s = LABLE;
-    for (char c : file)
+        return 4;
+    }
+    if (incremental)
     {
-        switch (s)
-        {
-        case LABLE:
-            if (c == '>') // 遇到 '>' 表示标签结束，进入内容区
-                s = CONTENT;
-            break;
-        case CONTENT:
-            if (c == '<') // 遇到 '<' 表示又开始一个新标签
-                s = LABLE;
-            else
-            {
-                // 我们不想保留原始文件中的\n, 因为我们想用\n作为html解析之后文本的分隔符
-                if (c == '\n')
-                    c = ' ';
-                content->push_back(c);
-            }
-            break;
-        default:
-            break;
-        }
+        logMsg(NORMAL, "增量解析完成, 文件数: %lu, 重新读取: %lu, 新增或修改: %lu, 删除: %lu",
+               (unsigned long)files_list.size(), (unsigned long)todo.size(),
+               (unsigned long)updates.size(), (unsigned long)deletes.size());
     }
 
-    return true;
-}
-
-// 
-static bool ParseUrl(const string &file_path, string *url)
-{
-    // string url_head = "https://www.boost.org/doc/libs/1_89_0/doc/html";
-    string url_head = "https://www.boost.org/doc/libs/latest/doc/html";
-    string url_tail = file_path.substr(src_path.size());
-    *url = url_head + url_tail;
-
-    return true;
+    return 0;
 }
-
+  
 // 测试函数1
 void ShowDoc(const DocInfo_t &doc)
 {
@@ -212,57 +202,110 @@ void ShowDoc(const DocInfo_t &doc)
 }
 
 // 对【files_list】数组中的每个文件进行解析
-bool ParseHtml(const vector<string> &files_list, vector<DocInfo_t> *results)
+// thread_num个线程每次领取PARSE_BATCH个文件(文件大小差别很大, 动态领取比平均切分更均衡)
+// 第i个文件的结果放在第i个位置, parsed[i]表示是否解析成功, hashes[i]是文件内容的hash, 所以结果和单线程解析完全一样
+bool ParseHtml(const vector<string> &files_list, vector<DocInfo_t> *results, vector<char> *parsed,
+               vector<uint64_t> *hashes, int thread_num)
 {
-    int cnt = 1; // 测试打印函数, 只打印3次
-    for (const string &file : files_list)
+    if (thread_num <= 0)
     {
-        
-        // 1.读取文件, Read();
-        string result; // 存放读取到的文件
-        if (!FileUtil::ReadFile(file, &result))
+        thread_num = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t batches = (files_list.size() + PARSE_BATCH - 1) / PARSE_BATCH;
+    thread_num = (int)std::max<size_t>(1, std::min<size_t>(thread_num, batches)); // 没有那么多批就少开几个线程
+
+    vector<DocInfo_t> &docs = *results;
+    docs.assign(files_list.size(), DocInfo_t());
+    parsed->assign(files_list.size(), 0);
+    hashes->assign(files_list.size(), 0);
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> total_bytes(0);
+    auto start = std::chrono::steady_clock::now();
+
+    auto work = [&]{
+        uint64_t bytes = 0;
+        while (true)
         {
-            continue; // 读取失败, 则继续处理下一个
+            size_t begin = next.fetch_add(PARSE_BATCH);
+            if (begin >= files_list.size())
+            {
+                break;
+            }
+            size_t end = std::min(begin + PARSE_BATCH, files_list.size());
+            for (size_t i = begin; i < end; i++)
+            {
+                size_t n = 0;
+                (*parsed)[i] = HtmlParser::ParseFile(src_path, files_list[i], &docs[i], &n, &(*hashes)[i]);
+                bytes += n;
+            }
         }
+        total_bytes += bytes;
+    };
+    vector<std::thread> threads;
+    for (int t = 1; t < thread_num; t++)
+    {
+        threads.emplace_back(work);
+    }
+    work(); // 当前线程也干活, thread_num为1时就是单线程解析
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
 
-        // 2.解析指定的文件, 提取title
-        DocInfo_t doc;
-        if (!ParseTitle(result, &doc.title))
-        {
-            continue;
-        }
+    // 走到这里, 一定是完成了解析任务, 当前文档的相关结果都保存在了【results】里面
+    size_t count = std::count(parsed->begin(), parsed->end(), 1);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mb = total_bytes / (1024.0 * 1024.0);
+    logMsg(NORMAL, "解析完成, 文件数: %lu, 文档数: %lu, 线程数: %d, %.1f MB, %.2f s, %.1f MB/s",
+           (unsigned long)files_list.size(), (unsigned long)count, thread_num,
+           mb, seconds, seconds > 0 ? mb / seconds : 0.0);
+    return true;
+}
 
-        // 3.解析指定的文件, 提取content(就是去标签)
-        if (!ParseContent(result, &doc.content))
-        {
-            continue;
-        }
+// 一个文档写成raw.txt中的一行: title\3content\3url\n
+static void AppendDoc(const DocInfo_t &item, string *out_string)
+{
+#define SEP '\3'
+    // title
+    *out_string += item.title;
+    *out_string += SEP;
 
-        // 4.解析指定的文件路径, 构建url
-        if(!ParseUrl(file, &doc.url))
-        {
-            continue;
-        }
+    // content
+    *out_string += item.content;
+    *out_string += SEP;
+
+    // url
+    *out_string += item.url;
+    *out_string += '\n';
+}
 
-        // 测试
-        //logMsg(DEBUG, "title: %s, content: %s, url: %s", doc.title.c_str(), doc.content.c_str(), doc.url.c_str());
-        if (cnt--)
+// 读取上次的raw.txt, 按url(每行最后一个\3之后)找到每一行, 保存的行包括最后的\n
+bool LoadLines(const string &input, std::unordered_map<string, string> *lines)
+{
+    std::ifstream in(input, std::ios::in | std::ios::binary);
+    if (!in.is_open())
+    {
+        return false;
+    }
+    string line;
+    while (std::getline(in, line))
+    {
+        size_t sep = line.rfind('\3');
+        if (sep == string::npos)
         {
-            //ShowDoc(doc); // 测试函数1
+            continue;
         }
-
-        // 走到这里, 一定是完成了解析任务, 当前文档的相关结果都保存在了【doc】里面
-        // 然后把解析完之后的【doc】放入到数组【results】中
-        // results->push_back(doc); // bug: 细节, 本质会发生拷贝, 效率可能会比较低
-        results->push_back(std::move(doc)); // 移动语义
-
+        string url = line.substr(sep + 1);
+        line += '\n';
+        (*lines)[url].swap(line);
     }
     return true;
 }
 
-bool SaveHtml(const vector<DocInfo_t> &results, const string &output)
+// 按files_list的顺序写出所有文档: 这次解析过的文件(fresh[i] >= 0)用新的结果, 其它文件拷贝上次raw.txt中的那一行
+bool SaveHtml(const vector<string> &files_list, const vector<int> &fresh, const vector<DocInfo_t> &results,
+              const vector<char> &parsed, const std::unordered_map<string, string> &old_lines, const string &output)
 {
-#define SEP '\3'
     // 按照二进制方式进行写入
     std::ofstream out(output, std::ios::out | std::ios::binary);
     if (!out.is_open())
@@ -270,23 +313,32 @@ bool SaveHtml(const vector<DocInfo_t> &results, const string &output)
         cerr << "open " << output << " failed!" << endl;
         return false;
     }
-    
+
     // 开始进行文件内容的写入了
     // 写入到txt中的第一行为: title\3content\3url
-    for (auto &item : results)
+    string out_string;
+    for (size_t i = 0; i < files_list.size(); i++)
     {
-        string out_string;
-        // title
-        out_string = item.title;
-        out_string += SEP;
-
-        // content
-        out_string += item.content;
-        out_string += SEP;
-
-        // url
-        out_string += item.url;
-        out_string += '\n';
+        out_string.clear();
+        if (fresh[i] >= 0)
+        {
+            if (!parsed[fresh[i]])
+            {
+                continue;
+            }
+            AppendDoc(results[fresh[i]], &out_string);
+        }
+        else
+        {
+            string url;
+            HtmlParser::ParseUrl(src_path, files_list[i], &url);
+            auto iter = old_lines.find(url);
+            if (iter == old_lines.end())
+            {
+                continue; // 上次就没有解析出来
+            }
+            out_string = iter->second;
+        }
 
         // 把字符串的内容写入到文件中
         out.write(out_string.c_str(), out_string.size());
@@ -294,5 +346,31 @@ bool SaveHtml(const vector<DocInfo_t> &results, const string &output)
 
     // 关闭
     out.close();
-    return true;
-}
\ No newline at end of file
+    return out.good();
+}
+
+// 增量解析的结果: update.txt和raw.txt格式相同, delete.txt每行一个url
+bool SaveDelta(const vector<DocInfo_t> &updates, const vector<string> &deletes)
+{
+    std::ofstream update(update_file, std::ios::out | std::ios::binary);
+    std::ofstream del(delete_file, std::ios::out | std::ios::binary);
+    if (!update.is_open() || !del.is_open())
+    {
+        cerr << "open " << update_file << " or " << delete_file << " failed!" << endl;
+        return false;
+    }
+    string out_string;
+    for (auto &item : updates)
+    {
+        out_string.clear();
+        AppendDoc(item, &out_string);
+        update.write(out_string.c_str(), out_string.size());
+    }
+    for (auto &url : deletes)
+    {
+        del << url << '\n';
+    }
+    update.close();
+    del.close();
+    return update.good() && del.good();
+}
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+// 压缩的倒排拉链
+// 一条拉链按doc_id升序, 每POSTING_BLOCK_SIZE个结点打包成一个块, 最后一个块可以不满
+// 块的格式: [块头][doc_id差值 * n, 每个doc_bits位][weight * n, 每个weight_bits位]
+// 块头: [doc_bits 1字节][weight_bits 1字节][last_doc 4字节][max_weight 4字节][position_size 4字节]
+// 差值是相对于前一个结点(第一个块的第一个结点相对于0)的, 块内按固定位宽打包, 解码是一个没有分支的循环
+// last_doc是块中最后一个doc_id, max_weight是块中最大的weight, position_size是块中的结点在位置区中的字节数
+// 查询时只看块头就能跳过整块, 也能知道块中weight的上界(Block-Max)
+// 解码时会一次读8个字节, 所以整个倒排区的末尾必须留出POSTING_PADDING个字节
+const uint32_t POSTING_BLOCK_SIZE = 128;
+const uint32_t POSTING_BLOCK_HEADER = 14;
+const uint32_t POSTING_PADDING = 8;
+
+class PostingCodec
+{
+public:
+    // 把一条拉链(doc_ids升序)编码后追加到out中
+    // position_sizes: 每个结点在位置区中的字节数, 不保存位置时为nullptr
+    static void Encode(const std::vector<uint32_t> &doc_ids, const std::vector<uint32_t> &weights,
+                       const std::vector<uint32_t> *position_sizes, std::string *out)
+    {
+        uint32_t prev = 0;
+        uint32_t deltas[POSTING_BLOCK_SIZE];
+        for (size_t begin = 0; begin < doc_ids.size(); begin += POSTING_BLOCK_SIZE)
+        {
+            uint32_t n = (uint32_t)std::min<size_t>(POSTING_BLOCK_SIZE, doc_ids.size() - begin);
+            uint32_t delta_bits = 0, weight_bits = 0, max_weight = 0, position_size = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                deltas[i] = doc_ids[begin + i] - prev;
+                prev = doc_ids[begin + i];
+                delta_bits |= deltas[i];
+                weight_bits |= weights[begin + i];
+                max_weight = std::max(max_weight, weights[begin + i]);
+                if (position_sizes != nullptr)
+                {
+                    position_size += (*position_sizes)[begin + i];
+                }
+            }
+            uint32_t doc_bits = BitsOf(delta_bits);
+            weight_bits = BitsOf(weight_bits);
+            out->push_back((char)doc_bits);
+            out->push_back((char)weight_bits);
+            out->append((const char *)&prev, sizeof(prev));
+            out->append((const char *)&max_weight, sizeof(max_weight));
+            out->append((const char *)&position_size, sizeof(position_size));
+            PackBits(deltas, n, doc_bits, out);
+            PackBits(&weights[begin], n, weight_bits, out);
+        }
+    }
+
+    // 按固定位宽解出n个数
+    static const char *UnpackBits(const char *in, uint32_t n, uint32_t bits, uint32_t *out)
+    {
+        if (bits == 0)
+        {
+            memset(out, 0, n * sizeof(uint32_t));
+            return in;
+        }
+        const uint64_t mask = (bits == 32) ? 0xffffffffULL : ((1ULL << bits) - 1);
+        uint64_t bit_pos = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint64_t word;
+            memcpy(&word, in + (bit_pos >> 3), sizeof(word));
+            out[i] = (uint32_t)((word >> (bit_pos & 7)) & mask);
+            bit_pos += bits;
+        }
+        return in + PackedBytes(n, bits);
+    }
+
+    static size_t PackedBytes(uint32_t n, uint32_t bits)
+    {
+        return ((uint64_t)n * bits + 7) / 8;
+    }
+
+    static uint32_t ReadU32(const char *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+private:
+    static uint32_t BitsOf(uint32_t v)
+    {
+        uint32_t bits = 0;
+        while (v)
+        {
+            bits++;
+            v >>= 1;
+        }
+        return bits;
+    }
+
+    static void PackBits(const uint32_t *in, uint32_t n, uint32_t bits, std::string *out)
+    {
+        size_t start = out->size();
+        out->resize(start + PackedBytes(n, bits), '\0');
+        unsigned char *p = (unsigned char *)&(*out)[start];
+        uint64_t bit_pos = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint64_t v = in[i];
+            for (uint32_t b = 0; b < bits; b += 8 - ((bit_pos + b) & 7))
+            {
+                uint64_t pos = bit_pos + b;
+                p[pos >> 3] |= (unsigned char)((v >> b) << (pos & 7));
+            }
+            bit_pos += bits;
+        }
+    }
+};
+
+// 关键字在文档正文中出现的位置(字节偏移量), 和拉链分开保存, 拉链中的每个结点对应一项
+// 一项的格式: [varint 后面的字节数][varint 位置差值 * n], 位置升序, 第一个差值相对于0
+// 关键字只出现在标题中时n为0; 有了字节数, 遍历拉链时不用解码就能跳过一项
+class PositionCodec
+{
+public:
+    // 把一个结点的位置(升序)编码后追加到out中
+    static void Encode(const std::vector<uint32_t> &positions, std::string *out)
+    {
+        uint32_t size = 0, prev = 0;
+        for (uint32_t p : positions)
+        {
+            size += VarintSize(p - prev);
+            prev = p;
+        }
+        PutVarint(size, out);
+        prev = 0;
+        for (uint32_t p : positions)
+        {
+            PutVarint(p - prev, out);
+            prev = p;
+        }
+    }
+
+    // 解出一项中的所有位置
+    static void Decode(const char *entry, std::vector<uint32_t> *positions)
+    {
+        positions->clear();
+        uint32_t size = 0, pos = 0, delta = 0;
+        entry = GetVarint(entry, &size);
+        for (const char *end = entry + size; entry < end; )
+        {
+            entry = GetVarint(entry, &delta);
+            pos += delta;
+            positions->push_back(pos);
+        }
+    }
+
+    // 第一个位置, 没有位置时返回false
+    static bool First(const char *entry, uint32_t *pos)
+    {
+        uint32_t size = 0;
+        entry = GetVarint(entry, &size);
+        if (size == 0)
+        {
+            return false;
+        }
+        GetVarint(entry, pos);
+        return true;
+    }
+
+    // 跳到下一项
+    static const char *Skip(const char *entry)
+    {
+        uint32_t size = 0;
+        entry = GetVarint(entry, &size);
+        return entry + size;
+    }
+
+private:
+    static uint32_t VarintSize(uint32_t v)
+    {
+        uint32_t size = 1;
+        while (v >= 0x80)
+        {
+            v >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    static void PutVarint(uint32_t v, std::string *out)
+    {
+        while (v >= 0x80)
+        {
+            out->push_back((char)(v | 0x80));
+            v >>= 7;
+        }
+        out->push_back((char)v);
+    }
+
+    static const char *GetVarint(const char *in, uint32_t *v)
+    {
+        uint32_t result = 0;
+        for (uint32_t shift = 0; shift < 35; shift += 7)
+        {
+            uint32_t byte = (unsigned char)*in++;
+            result |= (byte & 0x7f) << shift;
+            if (byte < 0x80)
+            {
+                break;
+            }
+        }
+        *v = result;
+        return in;
+    }
+};
+
+// 遍历一条压缩的倒排拉链, 每次解码一个块
+// PostingIterator it; for (; it.Valid(); it.Next()) { it.DocId(); it.Weight(); }
+// 段中保存了位置时, it.Positions()是当前结点在位置区中的那一项, 否则是nullptr
+// 查询时可以用SkipTo跳到某个doc_id, 用ShallowSkipTo + BlockMaxWeight只看块头估计上界
+class PostingIterator
+{
+private:
+    const char *block;           // 当前块
+    const char *block_positions; // 当前块在位置区中的开头
+    const char *positions;       // 当前结点的位置
+    uint32_t remaining;          // 当前块之后还有的结点个数
+    uint32_t block_size;         // 当前块中的结点个数
+    uint32_t pos;                // 当前结点在块中的位置
+    uint32_t base;               // 前一个块的last_doc, 当前块的第一个差值相对于它
+    bool decoded;                // 当前块是否已经解码
+    uint32_t doc_ids[POSTING_BLOCK_SIZE];
+    uint32_t weights[POSTING_BLOCK_SIZE];
+
+public:
+    PostingIterator()
+        : block(nullptr), block_positions(nullptr), positions(nullptr),
+          remaining(0), block_size(0), pos(0), base(0), decoded(true)
+    {}
+
+    PostingIterator(const char *data, uint32_t doc_count, const char *position_data = nullptr)
+        : block(data), block_positions(position_data), positions(position_data),
+          remaining(doc_count), block_size(0), pos(0), base(0), decoded(true)
+    {
+        EnterBlock();
+        DecodeBlock();
+    }
+
+    bool Valid() const { return pos < block_size; }
+    uint64_t DocId() const { return doc_ids[pos]; }
+    int Weight() const { return (int)weights[pos]; }
+    const char *Positions() const { return positions; }
+
+    // 当前块中最后一个doc_id和最大的weight, 不需要解码, Valid()时才能调用
+    uint64_t BlockLastDoc() const { return PostingCodec::ReadU32(block + 2); }
+    int BlockMaxWeight() const { return (int)PostingCodec::ReadU32(block + 6); }
+
+    void Next()
+    {
+        if (positions != nullptr)
+        {
+            positions = PositionCodec::Skip(positions);
+        }
+        if (++pos == block_size)
+        {
+            NextBlock();
+            DecodeBlock();
+        }
+    }
+
+    // 只看块头, 跳到可能包含target的块(last_doc >= target)上, 不解码
+    // 之后要调用SkipTo才能读取结点; 没有这样的块时Valid()返回false
+    void ShallowSkipTo(uint64_t target)
+    {
+        while (Valid() && BlockLastDoc() < target)
+        {
+            NextBlock();
+        }
+    }
+
+    // 跳到第一个doc_id >= target的结点上, 没有时Valid()返回false
+    void SkipTo(uint64_t target)
+    {
+        ShallowSkipTo(target);
+        if (!Valid())
+        {
+            return;
+        }
+        DecodeBlock();
+        while (doc_ids[pos] < target) // 块中最后一个doc_id >= target, 一定会停下来
+        {
+            if (positions != nullptr)
+            {
+                positions = PositionCodec::Skip(positions);
+            }
+            pos++;
+        }
+    }
+
+private:
+    uint32_t DocBits() const { return (unsigned char)block[0]; }
+    uint32_t WeightBits() const { return (unsigned char)block[1]; }
+
+    // 下一个块的块头, 不解码
+    void NextBlock()
+    {
+        base = (uint32_t)BlockLastDoc();
+        if (block_positions != nullptr)
+        {
+            block_positions += PostingCodec::ReadU32(block + 10);
+            positions = block_positions;
+        }
+        block += POSTING_BLOCK_HEADER + PostingCodec::PackedBytes(block_size, DocBits())
+               + PostingCodec::PackedBytes(block_size, WeightBits());
+        EnterBlock();
+    }
+
+    void EnterBlock()
+    {
+        block_size = remaining < POSTING_BLOCK_SIZE ? remaining : POSTING_BLOCK_SIZE;
+        remaining -= block_size;
+        pos = 0;
+        decoded = false;
+    }
+
+    void DecodeBlock()
+    {
+        if (decoded || block_size == 0)
+        {
+            return;
+        }
+        decoded = true;
+        const char *p = PostingCodec::UnpackBits(block + POSTING_BLOCK_HEADER, block_size, DocBits(), doc_ids);
+        PostingCodec::UnpackBits(p, block_size, WeightBits(), weights);
+
+        // 差值还原成doc_id
+        uint32_t doc_id = base;
+        for (uint32_t i = 0; i < block_size; i++)
+        {
+            doc_id += doc_ids[i];
+            doc_ids[i] = doc_id;
+        }
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+// 查询结果(序列化好的json串)的LRU缓存
+// 按key的hash分成QUERY_CACHE_SHARDS个分片, 每个分片一把锁, 并发的查询很少争用同一把锁
+// 每个分片最多使用budget / QUERY_CACHE_SHARDS字节, 超过时淘汰最久没有用过的结果
+// 结果记下了生成它的索引版本, 索引发布了新版本之后, 分片第一次看到新版本时清空自己, 旧结果不会再被返回
+const size_t QUERY_CACHE_SHARDS = 16;
+// 每个缓存项除了key和value之外大概的额外开销(链表结点, hash表结点)
+const size_t QUERY_CACHE_ENTRY_OVERHEAD = 128;
+
+class QueryCache
+{
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string value;
+    };
+
+    struct Shard
+    {
+        std::mutex mtx;
+        std::list<Entry> lru; // 最近用过的在前面
+        std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+        size_t bytes;
+        uint64_t version;     // 缓存的结果都是这个版本的索引生成的
+
+        Shard()
+            : bytes(0), version(0)
+        {}
+    };
+
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_budget;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;     // 因为内存不够被淘汰的
+    std::atomic<uint64_t> invalidations; // 因为索引版本变了被清掉的
+
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+public:
+    // budget: 内存上限(字节), 0表示不缓存
+    explicit QueryCache(size_t budget = 0)
+        : shards(new Shard[QUERY_CACHE_SHARDS]), shard_budget(budget / QUERY_CACHE_SHARDS),
+          hits(0), misses(0), evictions(0), invalidations(0)
+    {}
+
+    bool Enabled() const { return shard_budget > 0; }
+
+    // 设置内存上限, 只能在开始查询之前调用
+    void SetBudget(size_t budget)
+    {
+        shard_budget = budget / QUERY_CACHE_SHARDS;
+    }
+
+    // 查找version版本的索引上key的结果
+    bool Get(const std::string &key, uint64_t version, std::string *value)
+    {
+        if (!Enabled())
+        {
+            return false;
+        }
+        Shard &shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        Invalidate(&shard, version);
+        auto iter = shard.entries.find(key);
+        if (iter == shard.entries.end() || shard.version != version)
+        {
+            misses++;
+            return false;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+        *value = iter->second->value;
+        hits++;
+        return true;
+    }
+
+    // 放入version版本的索引上key的结果; 比分片中的结果旧的不放
+    void Put(const std::string &key, uint64_t version, const std::string &value)
+    {
+        size_t size = key.size() + value.size() + QUERY_CACHE_ENTRY_OVERHEAD;
+        if (!Enabled() || size > shard_budget)
+        {
+            return;
+        }
+        Shard &shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        Invalidate(&shard, version);
+        if (shard.version != version)
+        {
+            return;
+        }
+        auto iter = shard.entries.find(key);
+        if (iter != shard.entries.end())
+        {
+            Erase(&shard, iter);
+        }
+        shard.lru.push_front(Entry());
+        shard.lru.front().key = key;
+        shard.lru.front().value = value;
+        shard.entries[key] = shard.lru.begin();
+        shard.bytes += size;
+        while (shard.bytes > shard_budget)
+        {
+            Erase(&shard, shard.entries.find(shard.lru.back().key));
+            evictions++;
+        }
+    }
+
+    uint64_t Hits() const { return hits; }
+    uint64_t Misses() const { return misses; }
+    uint64_t Evictions() const { return evictions; }
+    uint64_t Invalidations() const { return invalidations; }
+
+    // 命中率, 还没有查询时为0
+    double HitRatio() const
+    {
+        uint64_t h = hits, m = misses;
+        return h + m == 0 ? 0 : (double)h / (h + m);
+    }
+
+    // 缓存的结果个数和占用的内存(估计值)
+    void Usage(size_t *count, size_t *bytes)
+    {
+        *count = 0;
+        *bytes = 0;
+        for (size_t i = 0; i < QUERY_CACHE_SHARDS; i++)
+        {
+            std::lock_guard<std::mutex> lock(shards[i].mtx);
+            *count += shards[i].entries.size();
+            *bytes += shards[i].bytes;
+        }
+    }
+
+private:
+    Shard &GetShard(const std::string &key)
+    {
+        return shards[std::hash<std::string>()(key) % QUERY_CACHE_SHARDS];
+    }
+
+    // 索引有了新版本, 清空分片
+    void Invalidate(Shard *shard, uint64_t version)
+    {
+        if (version <= shard->version)
+        {
+            return;
+        }
+        invalidations += shard->entries.size();
+        shard->entries.clear();
+        shard->lru.clear();
+        shard->bytes = 0;
+        shard->version = version;
+    }
+
+    void Erase(Shard *shard, std::unordered_map<std::string, std::list<Entry>::iterator>::iterator iter)
+    {
+        shard->bytes -= iter->second->key.size() + iter->second->value.size() + QUERY_CACHE_ENTRY_OVERHEAD;
+        shard->lru.erase(iter->second);
+        shard->entries.erase(iter);
+    }
+};
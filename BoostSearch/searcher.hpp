@@ -3,125 +3,319 @@
 #include "index.hpp"
 #include "util.hpp"
 #include "log.hpp"
+#include "accumulator.hpp"
+#include "query_cache.hpp"
+#include "json_writer.hpp"
+#include "metrics.hpp"
 #include <algorithm>
-#include <jsoncpp/json/json.h>
+#include <atomic>
+#include <chrono>
+
+// 不知道关键字在正文中的位置
+const uint32_t INVALID_POSITION = UINT32_MAX;
+// 每页默认的结果数
+const size_t SEARCH_PAGE_SIZE = 10;
+// 一页最多的结果数, 以及最多能翻到第几个结果(start + count)
+const size_t SEARCH_MAX_COUNT = 100;
+const size_t SEARCH_MAX_RESULTS = 1000;
+// 命中的文档数在这个数以内时是准确的; 超过之后MaxScore才开始跳过不可能进入前k个的文档, 总数只是一个下界
+const uint64_t TOTAL_HITS_THRESHOLD = 1000;
+// 一次查询最多使用的关键字(去重之后)和短语个数, 多出来的忽略; 命中的关键字用32位的掩码记录
+const size_t MAX_QUERY_TERMS = 32;
+// 段中这次查询的拉链总长度不超过这个数时, 用term-at-a-time直接累加,
+// 这时MaxScore能跳过的结点很少(命中的文档数还没到TOTAL_HITS_THRESHOLD), 不如顺序解码每条拉链
+const uint64_t TAAT_MAX_POSTINGS = 1024;
+// 估计查询代价时每个查询固定加上的开销(相当于遍历这么多个拉链结点): 分词, 排序, 生成摘要等
+const uint64_t QUERY_BASE_COST = 256;
 
 // 打印倒排拉链的结构体
 struct InvertedElemPrint
 {
     uint64_t doc_id;
     int weight;
-    vector<string> words;
+    uint32_t matched;  // 命中的关键字, 第i位表示查询中的第i个关键字
+    uint32_t word;     // 第一个命中的关键字在文档所在段中的term_id, 生成摘要时才转换成字符串
+    uint32_t pos;      // 第一个在正文中出现的关键字的位置, 摘要从这里截取
 
     //
     InvertedElemPrint()
-        : doc_id(0), weight(0)
+        : doc_id(0), weight(0), matched(0), word(INVALID_TERM_ID), pos(INVALID_POSITION)
     {}
 };
 
+// 一次查询的结果: 最好的k个文档, 以及命中的文档数
+struct TopHits
+{
+    size_t k;
+    vector<InvertedElemPrint> heap; // 堆顶是目前第k好的结果
+    uint64_t total;                 // 命中的文档数(不包括被删除的和不包含短语的)
+    bool exact;                     // total是否准确
+
+    explicit TopHits(size_t k)
+        : k(k), total(0), exact(true)
+    {
+        heap.reserve(k + 1);
+    }
+};
+
+// 查询中的一个关键字在某个段中的拉链
+struct QueryCursor
+{
+    PostingIterator iter;
+    uint32_t term;   // 查询中的第几个关键字
+    int times;       // 关键字在查询中出现的次数, 得分要乘上它
+    int max_weight;  // 得分的上界(已经乘了times)
+};
+
 class Searcher
 {
 private:
     Index *index; // 供系统进行查找的索引
+    string input;      // parser生成的raw.txt
+    string index_file; // index_builder生成的二进制索引文件
+    atomic<bool> reloading; // 同一时间只允许一个ReloadIndex
+    QueryCache cache;       // 查询结果缓存, 默认不缓存
+    SearchMetrics metrics;  // 各阶段的耗时
 
 public:
-    Searcher() {}
+    Searcher()
+        : index(nullptr), reloading(false)
+    {}
     ~Searcher() {}
 
 public:
-    void InitSearcher(const string &input)
+    // input: parser生成的raw.txt
+    // index_file: index_builder生成的二进制索引文件, 优先加载它, 加载失败再从input重新建立索引
+    void InitSearcher(const string &input, const string &index_file)
     {
         // 1.获取或者创建index对象(根据单例模式去获取)
         index = Index::GetInstance();
         logMsg(NORMAL, "获取index单例成功...");
 
+        // 2.建立索引
+        this->input = input;
+        this->index_file = index_file;
+        LoadOrBuildIndex();
+    }
+
+    // 重新加载索引(index_builder重新生成了索引文件, 或者raw.txt更新了), 在调用者的线程中完成
+    // 新索引建好之后才原子地替换旧索引: 正在进行的查询继续使用旧的快照, 之后的查询看到新索引
+    // 加载失败时旧索引保持不变; 内存段中增量加入的文档会被丢弃
+    bool ReloadIndex()
+    {
+        bool expected = false;
+        if (!reloading.compare_exchange_strong(expected, true))
+        {
+            logMsg(WARNING, "正在重新加载索引, 忽略这次请求...");
+            return false;
+        }
+        auto start = chrono::steady_clock::now();
+        bool ok = LoadOrBuildIndex();
+        reloading = false;
+        logMsg(ok ? NORMAL : ERROR, "重新加载索引%s, 用时%.3fs, 索引版本: %lu", ok ? "成功" : "失败",
+               chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+               (unsigned long)index->GetSnapshot()->version);
+        return ok;
+    }
+
+private:
+    bool LoadOrBuildIndex()
+    {
+        // 1.优先加载二进制索引文件
+        if (index->LoadIndex(index_file))
+        {
+            logMsg(NORMAL, "加载索引文件成功...");
+            return true;
+        }
+        logMsg(WARNING, "加载索引文件 %s 失败, 从 %s 重新建立索引...", index_file.c_str(), input.c_str());
+
         // 2.根据index对象建立索引
-        index->BuildIndex(input);
+        if (!index->BuildIndex(input))
+        {
+            return false;
+        }
         logMsg(NORMAL, "建立正排和倒排索引成功...");
+        return true;
+    }
+
+public:
+    // 读取raw.txt格式的文件, 把其中的文档加入索引(url相同的旧文档会被替换)
+    // delete_list: 同时删除的文档的url, 每行一个; 为空或者文件不存在时不删除
+    bool UpdateIndex(const string &input, const string &delete_list = "")
+    {
+        return index->UpdateIndex(input, delete_list);
+    }
+
+    // 加入一批文档(url相同的旧文档会被替换), 同时删除deleted中的url对应的文档, 在同一个快照中生效
+    void AddDocuments(vector<DocInfo> docs, const vector<string> &deleted)
+    {
+        index->AddDocuments(move(docs), deleted);
+    }
+
+    // 根据url删除文档
+    bool DeleteDocument(const string &url)
+    {
+        return index->DeleteDocument(url);
+    }
+
+    // 查询结果缓存的内存上限(字节), 0表示不缓存; 只能在开始查询之前调用
+    void SetCacheBudget(size_t budget)
+    {
+        cache.SetBudget(budget);
+    }
+
+    QueryCache &GetCache() { return cache; }
+    SearchMetrics &GetMetrics() { return metrics; }
+
+    // 估计一个查询的代价: 它要遍历的拉链长度之和(所有段), 再加上固定的开销
+    // 只分词和查词典, 不遍历拉链, 用来在查询排队之前决定是否接受它
+    uint64_t EstimateCost(const string &query) const
+    {
+        vector<string> phrases;
+        vector<string> terms;
+        vector<int> times;
+        ParseQuery(query, &phrases, &terms, &times);
+        shared_ptr<const IndexSnapshot> snapshot = index->GetSnapshot();
+        uint64_t cost = QUERY_BASE_COST;
+        for (size_t seg = 0; seg < snapshot->SegmentCount(); seg++)
+        {
+            const Segment &segment = snapshot->GetSegment(seg);
+            for (auto &term : terms)
+            {
+                cost += segment.DocFreq(term);
+            }
+        }
+        return cost;
     }
 
     //query: 搜索关键字
     //json_string: 返回给用户浏览器的搜索结果
-    void Search(string &query, string *json_string)
+    //start, count: 只返回排序之后的第[start, start + count)个结果, 只为这些结果生成摘要
+    void Search(string &query, string *json_string, size_t start = 0, size_t count = SEARCH_PAGE_SIZE)
     {
+        StageTimer timer; // 每个阶段结束时Lap一次, 最后记进metrics
+        count = max<size_t>(1, min(count, SEARCH_MAX_COUNT));
+        start = min(start, SEARCH_MAX_RESULTS - count);
+
         // 1.[分词]: 对我们的query进行按照searcher的要求进行分词
-        vector<string> words;
-        JiebaUtil::CutString(query, &words);
+        // 用双引号括起来的是短语: 短语中的词和其它词一样参与相关性计算, 但是结果必须包含整个短语
+        vector<string> phrases;
+        vector<string> terms;
+        vector<int> times;
+        ParseQuery(query, &phrases, &terms, &times);
 
-        // 2.[触发]: 就是根据分词的各个"词", 进行index查找, 建立index是忽略大小写, 所以搜索, 关键字也需要
-        //InvertedList inverted_list_all; // 它的内部是InvertedElem
-        vector<InvertedElemPrint> inverted_list_all; // 保存不重复的倒排拉链结点
-        // 根据doc_id去重
-        unordered_map<uint64_t, InvertedElemPrint> tokens_map;
+        // 整个查询都使用同一个快照, 不受同时进行的更新和段合并的影响
+        shared_ptr<const IndexSnapshot> snapshot = index->GetSnapshot();
 
-        for (string word : words)
+        timer.Lap(STAGE_SEGMENT);
+
+        // 同一个版本的索引上, 关键字和短语都相同(不管顺序)的查询结果相同, 直接用缓存的结果
+        string cache_key;
+        if (cache.Enabled())
         {
-            boost::to_lower(word); // 先把每个词转为小写
-            
-            InvertedList *inverted_list = index->GetInvertedList(word); // 获取倒排拉链
-            if (nullptr == inverted_list)
+            cache_key = CacheKey(terms, times, phrases, start, count);
+            bool cached = cache.Get(cache_key, snapshot->version, json_string);
+            timer.Lap(STAGE_CACHE);
+            if (cached)
             {
-                continue;
+                timer.Finish();
+                metrics.Record(timer);
+                return;
             }
-            //inverted_list_all.insert(inverted_list_all.end(), inverted_list->begin(), inverted_list->end());
-            // 遍历所有倒排拉链中的结点
-            for (const auto &elem : *inverted_list) // 将所有相同的word所对应的倒排拉链结点 ---合并为---> 一个InvertedElemPrint结点
+        }
+
+        // 结果必须包含所有短语: 第i个短语命中的文档(全局doc_id)在phrase_hits中的掩码第i位为1
+        ScoreAccumulator &phrase_hits = PhraseHits();
+        phrase_hits.Reset(snapshot->doc_count);
+        uint32_t phrase_mask = 0;
+        for (size_t i = 0; i < phrases.size() && i < MAX_QUERY_TERMS; i++)
+        {
+            if (MatchPhrase(*snapshot, phrases[i], (uint32_t)i, &phrase_hits))
             {
-                auto &item = tokens_map[elem.doc_id]; // []:如果存在直接获取，如果不存在新建
-                // item一定是doc_id相同的print节点
-                item.doc_id = elem.doc_id;
-                item.weight += elem.weight;
-                item.words.push_back(elem.word);     
-                // 即将一个倒排拉链中的4个结点合并为1个结点, 此时就做到了去重的功能
+                phrase_mask |= 1u << i;
             }
         }
-        // 此时inverted_list_all存放的就是去重之后的结果
-        for (const auto &item : tokens_map)
+        const ScoreAccumulator *filter = phrase_mask ? &phrase_hits : nullptr;
+        if (!phrases.empty())
         {
-            inverted_list_all.push_back(move(item.second)); // 
+            timer.Lap(STAGE_PHRASE);
         }
 
-        // 3.[合并排序]: 汇总查找结果, 按照相关性(weight)降序排序
-        // 第三个参数是: lambda表达式写法(也可以写一个回调函数)
-        // sort(inverted_list_all.begin(), inverted_list_all.end(), \
-        //     [](const InvertedElem &e1, const InvertedElem &e2){
-        //     return e1.weight > e2.weight;
-        //     });
-        sort(inverted_list_all.begin(), inverted_list_all.end(), \
-            [](const InvertedElemPrint &e1, const InvertedElemPrint &e2){
-            return e1.weight > e2.weight;
-            });
+        // 3.[合并排序]: 每个段依次求前start + count个结果, 所有段共用一个堆, 堆顶是目前第k好的结果
+        // 相关性(weight)相同时doc_id小的在前; 段按doc_id从小到大处理, 所以后来的文档平分时进不了堆
+        TopHits hits(start + count);
+        for (size_t seg = 0; seg < snapshot->SegmentCount(); seg++)
+        {
+            SearchSegment(*snapshot, seg, terms, times, filter, phrase_mask, &hits, &timer);
+        }
+        sort(hits.heap.begin(), hits.heap.end(), Better);
+        timer.Lap(STAGE_SORT);
+        // 只保留这一页
+        vector<InvertedElemPrint> inverted_list_all;
+        if (hits.heap.size() > start)
+        {
+            inverted_list_all.assign(hits.heap.begin() + start, hits.heap.end());
+        }
+        for (auto &item : inverted_list_all)
+        {
+            FillHit(*snapshot, terms, &item);
+        }
 
-        // 4.[构建]: 根据查找出来的结果, 构建json串 -- jsoncpp -- 通过jsoncpp完成序列化&&反序列化
-        Json::Value root; // 进行序列化 ---> 本质就是把K&V转化为JSON字符串
+        // 4.[构建]: 根据查找出来的结果, 直接拼出json串
+        // {"total": 命中的文档数, "exact": total是否准确, "start": start, "results": [这一页的结果]}
+        // 标题和url在建索引时就转义好了, 只有摘要需要现在转义
+        json_string->clear();
+        JsonWriter writer(json_string);
+        writer.BeginObject();
+        writer.Key("total");
+        writer.Uint(hits.total);
+        writer.Key("exact");
+        writer.Bool(hits.exact);
+        writer.Key("start");
+        writer.Uint(start);
+        writer.Key("results");
+        writer.BeginArray();
+        string content; // 正文是压缩存储的, 只有生成摘要的时候才解压
         for (auto &item : inverted_list_all) // 每一个item是InvertedElem
         {
-            DocInfo *doc = index->GetForwardIndex(item.doc_id);
+            const DocInfo *doc = snapshot->GetForwardIndex(item.doc_id);
             if (nullptr == doc)
             {
                 continue;
             }
-            Json::Value elem;
-            elem["title"] = doc->title;
-            //elem["desc"] = doc->content; // content是文档的去标签的结果，但是不是我们想要的，我们要的是一部分
-            elem["desc"] = GetDesc(doc->content, item.words[0]); // 提取一小部分内容, 当作摘要
-            elem["url"] = doc->url;
-
+            snapshot->GetContent(item.doc_id, &content);
+            string desc = GetDesc(content, snapshot->GetTerm(item.doc_id, item.word), item.pos); // 提取一小部分内容, 当作摘要
+            timer.Lap(STAGE_SNIPPET);
+            writer.BeginObject();
+            writer.Key("title");
+            writer.Raw(doc->title_json);
+            writer.Key("desc");
+            writer.String(desc);
+            writer.Key("url");
+            writer.Raw(doc->url_json);
             // 可以把id和权值打印出来看看(后续可以删除)
-            elem["id"] = (int)item.doc_id;
-            elem["weight"] = item.weight; //int->string
-
-            root.append(elem);
+            writer.Key("id");
+            writer.Uint(item.doc_id);
+            writer.Key("weight");
+            writer.Int(item.weight);
+            writer.EndObject();
+            timer.Lap(STAGE_JSON);
         }
-
-        // 构建序列化
-        //Json::StyledWriter writer; // 这个是方便调试
-        Json::FastWriter writer; // 这个更快
-        *json_string = writer.write(root);
+        writer.EndArray();
+        writer.EndObject();
+        timer.Lap(STAGE_JSON);
+        if (cache.Enabled())
+        {
+            cache.Put(cache_key, snapshot->version, *json_string);
+            timer.Lap(STAGE_CACHE);
+        }
+        timer.Finish();
+        metrics.Record(timer);
     }
 
     // 获取摘要
-    string GetDesc(const string &html_content, const string &word)
+    // word_pos: 索引中记录的关键字在正文中的位置, INVALID_POSITION表示不知道, 这时才在正文中查找word
+    string GetDesc(const string &html_content, const string &word, uint32_t word_pos = INVALID_POSITION)
     {
         // 找到word在html_content中的首次出现，然后往前找50字节(如果没有，从begin开始)，往后找100字节(如果没有，到end就可以的)
         // 截取出这部分内容
@@ -136,15 +330,23 @@ public:
         // {
         //     return "None1";
         // }
-        auto iter = search(html_content.begin(), html_content.end(), word.begin(), word.end(), [](int x, int y){
-                return (tolower(x) == tolower(y));
-                });
-        if (iter == html_content.end())
+        int pos = 0;
+        if (word_pos < html_content.size())
         {
-            return "None1";
+            pos = (int)word_pos;
+        }
+        else
+        {
+            auto iter = search(html_content.begin(), html_content.end(), word.begin(), word.end(), [](int x, int y){
+                    return (tolower(x) == tolower(y));
+                    });
+            if (iter == html_content.end())
+            {
+                return "None1";
+            }
+            // 如果找到了, 计算迭代器和html_content开头之间的距离
+            pos = distance(html_content.begin(), iter);
         }
-        // 如果找到了, 计算迭代器和html_content开头之间的距离
-        int pos = distance(html_content.begin(), iter);
 
         // 2. 获取start, end, (size_t无符号整数)
         int start = 0;
@@ -161,6 +363,467 @@ public:
         desc += "....";
         return desc;
     }
+
+private:
+    // 结果的先后: weight大的在前, 相同时doc_id小的在前
+    static bool Better(const InvertedElemPrint &e1, const InvertedElemPrint &e2)
+    {
+        return e1.weight > e2.weight || (e1.weight == e2.weight && e1.doc_id < e2.doc_id);
+    }
+
+    static bool IsBlank(const string &word)
+    {
+        return all_of(word.begin(), word.end(), [](char c){ return isspace((unsigned char)c); });
+    }
+
+    // 缓存的key: 按字典序排好的关键字(和出现次数), 排好的短语, 以及要返回的结果范围, 用'\0'分隔
+    static string CacheKey(const vector<string> &terms, const vector<int> &times, vector<string> phrases,
+                           size_t start, size_t count)
+    {
+        vector<size_t> order(terms.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&terms](size_t a, size_t b){ return terms[a] < terms[b]; });
+        sort(phrases.begin(), phrases.end());
+
+        string key = to_string(start) + ',' + to_string(count);
+        key += '\0';
+        for (size_t i : order)
+        {
+            key += terms[i];
+            key += '\0';
+            key += to_string(times[i]);
+            key += '\0';
+        }
+        key += '\0'; // 关键字不会是空串, 所以这里可以把关键字和短语分开
+        for (auto &phrase : phrases)
+        {
+            key += phrase;
+            key += '\0';
+        }
+        return key;
+    }
+
+    // 每个线程一个, 在查询之间复用
+    static ScoreAccumulator &Scores()
+    {
+        static thread_local ScoreAccumulator scores;
+        return scores;
+    }
+
+    static ScoreAccumulator &PhraseHits()
+    {
+        static thread_local ScoreAccumulator phrase_hits;
+        return phrase_hits;
+    }
+
+    // 文档是否包含所有短语, filter为nullptr表示没有短语
+    static bool PassFilter(const ScoreAccumulator *filter, uint32_t phrase_mask, uint64_t doc_id)
+    {
+        return filter == nullptr || filter->Mask((uint32_t)doc_id) == phrase_mask;
+    }
+
+    // 如果item能进入top-k, 就放进堆(堆顶是最差的结果, 最多k个)
+    static void PushHeap(const InvertedElemPrint &item, TopHits *hits)
+    {
+        vector<InvertedElemPrint> *heap = &hits->heap;
+        heap->push_back(item);
+        push_heap(heap->begin(), heap->end(), Better);
+        if (heap->size() > hits->k)
+        {
+            pop_heap(heap->begin(), heap->end(), Better);
+            heap->pop_back();
+        }
+    }
+
+    // 在一个段中求top-k, 结果放进hits
+    // 拉链都很短时用TAAT(term-at-a-time)把得分累加进复用的稠密数组, 否则用DAAT的MaxScore跳过不可能进入top-k的文档
+    static void SearchSegment(const IndexSnapshot &snapshot, size_t seg, const vector<string> &terms,
+                              const vector<int> &times, const ScoreAccumulator *filter, uint32_t phrase_mask,
+                              TopHits *hits, StageTimer *timer)
+    {
+        const Segment &segment = snapshot.GetSegment(seg);
+        vector<QueryCursor> cursors;
+        cursors.reserve(terms.size());
+        uint64_t postings = 0;
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            uint32_t term_id = segment.GetTermId(terms[i]);
+            cursors.emplace_back();
+            QueryCursor &cursor = cursors.back();
+            if (!segment.GetInvertedList(term_id, &cursor.iter))
+            {
+                cursors.pop_back();
+                continue;
+            }
+            cursor.term = (uint32_t)i;
+            cursor.times = times[i];
+            cursor.max_weight = times[i] * segment.GetMaxWeight(term_id);
+            postings += segment.DocFreq(term_id);
+        }
+        timer->Lap(STAGE_LOOKUP);
+        if (cursors.empty())
+        {
+            return;
+        }
+        if (postings <= TAAT_MAX_POSTINGS)
+        {
+            SearchSegmentTaat(snapshot, seg, &cursors, filter, phrase_mask, hits);
+        }
+        else
+        {
+            SearchSegmentDaat(snapshot, seg, &cursors, filter, phrase_mask, hits);
+        }
+        timer->Lap(STAGE_MERGE);
+    }
+
+    // TAAT: 依次把每条拉链的得分加进稠密数组, 最后只看被加过分的文档
+    static void SearchSegmentTaat(const IndexSnapshot &snapshot, size_t seg, vector<QueryCursor> *cursors,
+                                  const ScoreAccumulator *filter, uint32_t phrase_mask, TopHits *hits)
+    {
+        ScoreAccumulator &scores = Scores();
+        scores.Reset(snapshot.GetSegment(seg).DocCount());
+        for (auto &cursor : *cursors)
+        {
+            for (PostingIterator &iter = cursor.iter; iter.Valid(); iter.Next())
+            {
+                scores.Add((uint32_t)iter.DocId(), cursor.times * iter.Weight(), cursor.term);
+            }
+        }
+
+        // touched是按拉链的顺序加入的, 不是按doc_id, 所以平分时也要和堆顶比较doc_id
+        for (uint32_t doc_id : scores.Touched())
+        {
+            InvertedElemPrint item;
+            item.doc_id = snapshot.GetBase(seg) + doc_id;
+            if (snapshot.IsDeleted(seg, doc_id) || !PassFilter(filter, phrase_mask, item.doc_id))
+            {
+                continue;
+            }
+            hits->total++;
+            item.weight = scores.Score(doc_id);
+            item.matched = scores.Mask(doc_id);
+            if (hits->heap.size() == hits->k && !Better(item, hits->heap.front()))
+            {
+                continue;
+            }
+            PushHeap(item, hits);
+        }
+    }
+
+    // DAAT(document-at-a-time)的MaxScore
+    // 命中的文档数达到TOTAL_HITS_THRESHOLD之前不跳过任何文档, 这样结果少的查询总数是准确的
+    // 拉链按得分上界从小到大排好, 前面几条的上界加起来都不超过门槛(堆顶的weight)时, 只包含它们的文档不可能进入top-k,
+    // 这几条就是"非必要"的: 只从其余"必要"的拉链中取候选文档, 非必要的拉链只用SkipTo去查候选文档,
+    // 查之前先用块头中的weight上界(Block-Max)判断一下, 加上也进不了堆就直接放弃这个候选
+    static void SearchSegmentDaat(const IndexSnapshot &snapshot, size_t seg, vector<QueryCursor> *cursor_list,
+                                  const ScoreAccumulator *filter, uint32_t phrase_mask, TopHits *hits)
+    {
+        vector<QueryCursor> &cursors = *cursor_list;
+        sort(cursors.begin(), cursors.end(), [](const QueryCursor &c1, const QueryCursor &c2){
+            return c1.max_weight < c2.max_weight;
+            });
+        vector<int> upper(cursors.size()); // upper[i]: 前i + 1条拉链的上界之和
+        for (size_t i = 0; i < cursors.size(); i++)
+        {
+            upper[i] = cursors[i].max_weight + (i > 0 ? upper[i - 1] : 0);
+        }
+
+        size_t essential = 0; // [essential, size)是必要的拉链
+        while (true)
+        {
+            int threshold = -1;
+            if (hits->heap.size() == hits->k && hits->total >= TOTAL_HITS_THRESHOLD)
+            {
+                threshold = hits->heap.front().weight;
+                hits->exact = false;
+            }
+            while (essential < cursors.size() && upper[essential] <= threshold)
+            {
+                essential++;
+            }
+            if (essential == cursors.size())
+            {
+                break; // 剩下的文档都不可能进入top-k了
+            }
+
+            // 1. 候选文档: 必要的拉链中最小的doc_id
+            uint64_t doc_id = UINT64_MAX;
+            for (size_t i = essential; i < cursors.size(); i++)
+            {
+                if (cursors[i].iter.Valid())
+                {
+                    doc_id = min(doc_id, cursors[i].iter.DocId());
+                }
+            }
+            if (doc_id == UINT64_MAX)
+            {
+                break;
+            }
+
+            // 2. 必要的拉链中的得分, 顺便把它们移到下一个文档
+            int score = 0;
+            uint32_t matched = 0;
+            for (size_t i = essential; i < cursors.size(); i++)
+            {
+                PostingIterator &iter = cursors[i].iter;
+                if (iter.Valid() && iter.DocId() == doc_id)
+                {
+                    score += cursors[i].times * iter.Weight();
+                    matched |= 1u << cursors[i].term;
+                    iter.Next();
+                }
+            }
+            uint64_t global_id = snapshot.GetBase(seg) + doc_id;
+            if (snapshot.IsDeleted(seg, (uint32_t)doc_id) || !PassFilter(filter, phrase_mask, global_id))
+            {
+                continue;
+            }
+            hits->total++;
+
+            // 3. 非必要的拉链, 从上界大的开始查, 上界不够就放弃
+            bool rejected = false;
+            for (size_t i = essential; i-- > 0; )
+            {
+                if (score + upper[i] <= threshold)
+                {
+                    rejected = true;
+                    break;
+                }
+                PostingIterator &iter = cursors[i].iter;
+                iter.ShallowSkipTo(doc_id);
+                if (!iter.Valid())
+                {
+                    continue;
+                }
+                if (score + cursors[i].times * iter.BlockMaxWeight() + (i > 0 ? upper[i - 1] : 0) <= threshold)
+                {
+                    rejected = true;
+                    break;
+                }
+                iter.SkipTo(doc_id);
+                if (iter.Valid() && iter.DocId() == doc_id)
+                {
+                    score += cursors[i].times * iter.Weight();
+                    matched |= 1u << cursors[i].term;
+                }
+            }
+            if (rejected || score <= threshold)
+            {
+                continue;
+            }
+
+            // 4. 进堆
+            InvertedElemPrint item;
+            item.doc_id = global_id;
+            item.weight = score;
+            item.matched = matched;
+            PushHeap(item, hits);
+        }
+    }
+
+    // 找出结果中第一个命中的关键字和摘要的位置, 只对最后返回的结果做
+    static void FillHit(const IndexSnapshot &snapshot, const vector<string> &terms, InvertedElemPrint *item)
+    {
+        size_t seg = 0;
+        while (seg + 1 < snapshot.SegmentCount() && snapshot.GetBase(seg + 1) <= item->doc_id)
+        {
+            seg++;
+        }
+        const Segment &segment = snapshot.GetSegment(seg);
+        uint64_t doc_id = item->doc_id - snapshot.GetBase(seg);
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            if (!(item->matched & (1u << i)))
+            {
+                continue;
+            }
+            uint32_t term_id = segment.GetTermId(terms[i]);
+            if (item->word == INVALID_TERM_ID)
+            {
+                item->word = term_id;
+            }
+            // 段中保存了位置, 摘要就不用再在正文中查找关键字了
+            PostingIterator iter;
+            if (!segment.HasPositions() || !segment.GetInvertedList(term_id, &iter))
+            {
+                break;
+            }
+            iter.SkipTo(doc_id);
+            if (iter.Valid() && iter.DocId() == doc_id && PositionCodec::First(iter.Positions(), &item->pos))
+            {
+                break;
+            }
+        }
+    }
+
+    // 把查询切成短语和关键字: 短语也参与分词; 关键字转成小写, 相同的合并成一个, 出现几次权重就算几次
+    // 空白不参与相关性计算(几乎每个文档都有); 最多MAX_QUERY_TERMS个不同的关键字
+    static void ParseQuery(const string &query, vector<string> *phrases, vector<string> *terms, vector<int> *times)
+    {
+        vector<string> parts;
+        SplitPhrases(query, phrases, &parts);
+        parts.insert(parts.end(), phrases->begin(), phrases->end());
+        vector<string> words;
+        for (auto &part : parts)
+        {
+            vector<string> part_words;
+            JiebaUtil::CutString(part, &part_words);
+            words.insert(words.end(), part_words.begin(), part_words.end());
+        }
+        for (string word : words)
+        {
+            boost::to_lower(word); // 建立index是忽略大小写, 所以搜索关键字也需要
+            if (IsBlank(word))
+            {
+                continue;
+            }
+            auto iter = find(terms->begin(), terms->end(), word);
+            if (iter == terms->end() && terms->size() == MAX_QUERY_TERMS)
+            {
+                continue;
+            }
+            if (iter == terms->end())
+            {
+                terms->push_back(word);
+                times->push_back(1);
+            }
+            else
+            {
+                (*times)[iter - terms->begin()]++;
+            }
+        }
+    }
+
+    // 把query中用双引号括起来的部分放进phrases, 其余部分放进others; 没有配对的引号当作普通字符
+    static void SplitPhrases(const string &query, vector<string> *phrases, vector<string> *others)
+    {
+        size_t pos = 0;
+        while (true)
+        {
+            size_t begin = query.find('"', pos);
+            size_t end = (begin == string::npos) ? string::npos : query.find('"', begin + 1);
+            if (end == string::npos)
+            {
+                others->push_back(query.substr(pos));
+                break;
+            }
+            others->push_back(query.substr(pos, begin - pos));
+            phrases->push_back(query.substr(begin + 1, end - begin - 1));
+            pos = end + 1;
+        }
+    }
+
+    // 找出包含短语的文档, 在hits中把它们(全局doc_id)的掩码第index位置为1, 短语中没有可以查找的词时返回false
+    // 先对短语中各个词的拉链求交集; 段中保存了位置时, 每个词都要出现在和短语中相同的相对位置上,
+    // 否则解压正文查找整个短语
+    static bool MatchPhrase(const IndexSnapshot &snapshot, const string &phrase, uint32_t index, ScoreAccumulator *hits)
+    {
+        // 1. 短语分词, 记录每个词相对于短语开头的字节偏移量
+        // 词之间的空白和标点也是词, 也要出现在对应的位置上, 所以"split iterator"不会匹配split_iterator
+        vector<cppjieba::Word> cut;
+        JiebaUtil::CutString(phrase, &cut);
+        vector<string> terms;
+        vector<uint32_t> offsets;
+        uint32_t first = UINT32_MAX, last = 0;
+        bool blank = true;
+        for (auto &w : cut)
+        {
+            boost::to_lower(w.word);
+            first = min(first, w.offset);
+            last = max(last, w.offset + (uint32_t)w.word.size());
+            blank = blank && IsBlank(w.word);
+            terms.push_back(w.word);
+            offsets.push_back(w.offset);
+        }
+        if (blank)
+        {
+            return false;
+        }
+        for (auto &offset : offsets)
+        {
+            offset -= first;
+        }
+        const string text = phrase.substr(first, last - first);
+
+        // 2. 每个段分别求交集
+        vector<vector<uint32_t>> positions(terms.size());
+        for (size_t seg = 0; seg < snapshot.SegmentCount(); seg++)
+        {
+            const Segment &segment = snapshot.GetSegment(seg);
+            vector<PostingIterator> iters(terms.size());
+            bool found = true;
+            for (size_t i = 0; i < terms.size() && found; i++)
+            {
+                found = segment.GetInvertedList(segment.GetTermId(terms[i]), &iters[i]);
+            }
+            if (!found)
+            {
+                continue;
+            }
+            for (; iters[0].Valid(); iters[0].Next())
+            {
+                uint64_t doc_id = iters[0].DocId();
+                bool all = true;
+                for (size_t i = 1; i < iters.size() && all; i++)
+                {
+                    while (iters[i].Valid() && iters[i].DocId() < doc_id)
+                    {
+                        iters[i].Next();
+                    }
+                    all = iters[i].Valid() && iters[i].DocId() == doc_id;
+                }
+                if (!all || snapshot.IsDeleted(seg, (uint32_t)doc_id))
+                {
+                    continue;
+                }
+
+                bool hit = false;
+                if (segment.HasPositions())
+                {
+                    for (size_t i = 0; i < iters.size(); i++)
+                    {
+                        PositionCodec::Decode(iters[i].Positions(), &positions[i]);
+                    }
+                    hit = PhraseAt(positions, offsets);
+                }
+                else
+                {
+                    string content;
+                    segment.GetContent((uint32_t)doc_id, &content);
+                    hit = search(content.begin(), content.end(), text.begin(), text.end(), [](int x, int y){
+                            return (tolower(x) == tolower(y));
+                            }) != content.end();
+                }
+                if (hit)
+                {
+                    hits->Add((uint32_t)(snapshot.GetBase(seg) + doc_id), 0, index);
+                }
+            }
+        }
+        return true;
+    }
+
+    // positions[i]是第i个词在文档中的位置(升序), 是否存在一个起点start, 使得每个词都出现在start + offsets[i]
+    static bool PhraseAt(const vector<vector<uint32_t>> &positions, const vector<uint32_t> &offsets)
+    {
+        size_t k = min_element(offsets.begin(), offsets.end()) - offsets.begin(); // 偏移量为0的词
+        for (uint32_t start : positions[k])
+        {
+            bool ok = true;
+            for (size_t i = 0; i < positions.size() && ok; i++)
+            {
+                ok = binary_search(positions[i].begin(), positions[i].end(), start + offsets[i]);
+            }
+            if (ok)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
 };
 
 
@@ -0,0 +1,1073 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include "log.hpp"
+#include "util.hpp"
+#include "posting.hpp"
+#include "doc_store.hpp"
+#include "bm25.hpp"
+#include "json_writer.hpp"
+
+using namespace std;
+
+struct DocInfo
+{
+    string title;      //文档的标题
+    string content;    //文档内容(去标签之后), 建好段之后压缩进DocStore, 这里就是空的了
+    string url;        //该文档在官网中的url
+    uint64_t doc_id;   //文档的ID(在所属的段中的下标)
+    uint32_t title_len;   //标题分词之后的词数, BM25F按它做长度归一化
+    uint32_t content_len; //正文分词之后的词数
+    string title_json; //转义好的标题(带引号), 查询结果直接拷贝它
+    string url_json;   //转义好的url
+};
+
+// 倒排的文件元素(关键字由所在的拉链决定, 不需要在每个结点里再存一份)
+struct InvertedElem
+{
+    uint64_t doc_id;    // ID
+    int weight;         // 权重: BM25F得分量化之后的impact
+    uint32_t title_cnt;   // 关键字在标题中出现的次数, 只在算impact之前有用
+    uint32_t content_cnt; // 关键字在正文中出现的次数
+    vector<uint32_t> positions; // 关键字在正文中的位置(字节偏移量), 升序; 段不保存位置时为空
+
+    InvertedElem()
+        : weight(0), title_cnt(0), content_cnt(0)
+    {}
+};
+
+//倒排拉链(建立索引时使用, 建完之后压缩成PostingCodec的格式)
+typedef vector<InvertedElem> InvertedList;
+
+// 建立索引的线程私有的拉链: 关键字 -> 拉链
+typedef unordered_map<string, InvertedList> TermMap;
+
+// 不存在的关键字
+const uint32_t INVALID_TERM_ID = UINT32_MAX;
+// 不存在的文档(段内的下标)
+const uint32_t INVALID_DOC_ID = UINT32_MAX;
+
+// 一条压缩的倒排拉链在倒排区中的位置
+struct PostingListInfo
+{
+    uint64_t offset;          // 相对倒排区开头的偏移量
+    uint64_t position_offset; // 相对位置区开头的偏移量
+    uint32_t doc_count;       // 拉链中的结点个数
+    uint32_t max_weight;      // 拉链中最大的weight, 查询时作为这个关键字得分的上界
+
+    PostingListInfo()
+        : offset(0), position_offset(0), doc_count(0), max_weight(0)
+    {}
+};
+
+// 二进制索引文件(data/index/index.bin)的格式, 整数都按本机字节序保存, 一个文件就是一个段
+// [IndexFileHeader][IndexFileDoc * doc_count][ContentBlock * block_count][IndexFileTerm * term_count]
+// [倒排区 posting_size字节][位置区 position_size字节][正文区 content_size字节][字符串区]
+// 倒排区就是各条压缩拉链(PostingCodec)首尾相连, 末尾留POSTING_PADDING个字节, 加载时直接在映射的内存上解码
+// 位置区是各条拉链的位置(PositionCodec), 只有flags中有INDEX_FLAG_POSITIONS时才有
+// 正文区是DocStore压缩的正文块, 也是在映射的内存上按需解压
+// 格式有任何变化都要增加INDEX_FILE_VERSION, 旧版本的文件会被拒绝加载
+const char INDEX_FILE_MAGIC[8] = {'B', 'S', 'I', 'N', 'D', 'E', 'X', '\0'};
+const uint32_t INDEX_FILE_VERSION = 6;
+const uint32_t INDEX_FLAG_POSITIONS = 1; // 保存了关键字在正文中的位置
+
+struct IndexFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t doc_count;
+    uint64_t term_count;
+    uint64_t posting_size;
+    uint64_t position_size;
+    uint64_t block_count;
+    uint64_t content_size;
+    uint64_t doc_offset;      // 各区相对文件开头的偏移量
+    uint64_t block_offset;
+    uint64_t term_offset;
+    uint64_t posting_offset;
+    uint64_t position_offset;
+    uint64_t content_offset;
+    uint64_t string_offset;
+    uint64_t file_size;       // 用来检查文件是否被截断
+};
+
+// 字符串区中的一段
+struct IndexFileString
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+// 正排: 下标就是doc_id, title和url在字符串区, 正文在正文区
+struct IndexFileDoc
+{
+    IndexFileString title;
+    IndexFileString url;
+    DocContent content;
+    uint32_t title_len;
+    uint32_t content_len;
+};
+
+// 词表: 按关键字排序, 每个关键字对应倒排区中的一条压缩拉链
+struct IndexFileTerm
+{
+    IndexFileString word;
+    uint64_t posting_offset;
+    uint64_t position_offset;
+    uint64_t doc_count;
+    uint32_t max_weight;
+    uint32_t reserved;
+};
+
+// 段中被删除的文档, 一个文档一个bit
+class DeleteBitmap
+{
+private:
+    vector<uint64_t> bits;
+    uint32_t count; // 被删除的文档个数
+
+public:
+    DeleteBitmap()
+        : count(0)
+    {}
+
+    bool Test(uint32_t doc_id) const
+    {
+        return doc_id / 64 < bits.size() && ((bits[doc_id / 64] >> (doc_id % 64)) & 1);
+    }
+
+    void Set(uint32_t doc_id)
+    {
+        if (Test(doc_id))
+        {
+            return;
+        }
+        if (doc_id / 64 >= bits.size())
+        {
+            bits.resize(doc_id / 64 + 1, 0);
+        }
+        bits[doc_id / 64] |= 1ULL << (doc_id % 64);
+        count++;
+    }
+
+    uint32_t Count() const { return count; }
+};
+
+// 段: 一批文档的正排和倒排索引, 建好之后就不再修改, 所以可以被多个线程同时查询
+// 文档在段内的下标就是它的doc_id, 拉链中保存的也是段内的doc_id
+class Segment
+{
+private:
+    // 正排索引的数据结构用数组, 数组的下标天然是文档的ID
+    vector<DocInfo> forward_index; // 正排索引, 只有title和url常驻内存
+    DocStore doc_store;            // 压缩的正文
+    unordered_map<string, uint32_t> url_ids; // url -> doc_id, 用来更新/删除文档
+    uint64_t title_tokens;   // 所有文档标题的词数之和, 新文档算BM25F时作为全集的统计信息
+    uint64_t content_tokens; // 所有文档正文的词数之和
+
+    // 词典: 每个关键字对应一个稠密的term_id, 拉链和查询过程中只使用term_id
+    unordered_map<string, uint32_t> term_ids;
+    vector<string> terms; // term_id -> 关键字
+
+    // 倒排索引一定是一个关键字和一组(个)InvertedElem对应【关键字和倒排拉链的映射关系】
+    // 下标是term_id, 拉链都是压缩过的, 数据在posting_data指向的倒排区中
+    vector<PostingListInfo> inverted_index;
+
+    const char *posting_data;  // 倒排区: 指向posting_pool或者index_map
+    string posting_pool;       // 内存中建立的倒排区
+    const char *position_data; // 位置区: 指向position_pool或者index_map, 不保存位置时是nullptr
+    string position_pool;      // 内存中建立的位置区
+    MmapFile index_map;        // Load映射的索引文件
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+public:
+    Segment()
+        : title_tokens(0), content_tokens(0), posting_data(nullptr), position_data(nullptr)
+    {}
+
+    // 用文档和它们的拉链建立一个段, 拉链中的doc_id是docs的下标, 而且是升序的
+    // positions: 是否保存拉链结点中的位置
+    void Init(vector<DocInfo> docs, TermMap postings, bool positions)
+    {
+        forward_index.swap(docs);
+        doc_store.Build(forward_index.size(), [this](size_t i) -> const string & {
+            return forward_index[i].content;
+            });
+        url_ids.clear();
+        title_tokens = content_tokens = 0;
+        for (size_t i = 0; i < forward_index.size(); i++)
+        {
+            forward_index[i].doc_id = i;
+            string().swap(forward_index[i].content);
+            url_ids[forward_index[i].url] = (uint32_t)i;
+            forward_index[i].title_json = JsonWriter::Quote(forward_index[i].title);
+            forward_index[i].url_json = JsonWriter::Quote(forward_index[i].url);
+            title_tokens += forward_index[i].title_len;
+            content_tokens += forward_index[i].content_len;
+        }
+
+        // 分配term_id, 把所有的拉链压缩进倒排区, 位置写进位置区
+        term_ids.clear();
+        terms.clear();
+        inverted_index.clear();
+        string pool;
+        string position_buf;
+        vector<uint32_t> doc_ids;
+        vector<uint32_t> weights;
+        vector<uint32_t> position_sizes;
+        for (auto &pair : postings)
+        {
+            PostingListInfo info;
+            info.offset = pool.size();
+            info.position_offset = position_buf.size();
+            doc_ids.clear();
+            weights.clear();
+            position_sizes.clear();
+            for (const auto &elem : pair.second)
+            {
+                doc_ids.push_back((uint32_t)elem.doc_id);
+                weights.push_back((uint32_t)elem.weight);
+                info.max_weight = max(info.max_weight, (uint32_t)elem.weight);
+                if (positions)
+                {
+                    size_t before = position_buf.size();
+                    PositionCodec::Encode(elem.positions, &position_buf);
+                    position_sizes.push_back((uint32_t)(position_buf.size() - before));
+                }
+            }
+            InvertedList().swap(pair.second);
+
+            info.doc_count = (uint32_t)doc_ids.size();
+            PostingCodec::Encode(doc_ids, weights, positions ? &position_sizes : nullptr, &pool);
+
+            term_ids.insert(make_pair(pair.first, (uint32_t)terms.size()));
+            terms.push_back(pair.first);
+            inverted_index.push_back(info);
+        }
+        pool.append(POSTING_PADDING, '\0');
+
+        posting_pool.swap(pool);
+        posting_data = posting_pool.data();
+        position_pool.swap(position_buf);
+        position_data = positions ? position_pool.data() : nullptr;
+        index_map.Close();
+    }
+
+    // 把几个段中没有被删除的文档合并成一个新段, 拉链直接解码后重新编码, 不需要重新分词
+    // impact是文档加入索引时算好的, 合并时不再重新计算
+    // 只有所有的段都保存了位置, 新段才保存位置
+    // doc_maps[i][j]: 第i个段的第j个文档在新段中的doc_id, 被删除的是INVALID_DOC_ID
+    static shared_ptr<Segment> Merge(const vector<const Segment *> &segments,
+                                     const vector<const DeleteBitmap *> &deletes,
+                                     vector<vector<uint32_t>> *doc_maps)
+    {
+        // 1. 正排: 按段的顺序依次放入没有被删除的文档
+        vector<DocInfo> docs;
+        doc_maps->assign(segments.size(), vector<uint32_t>());
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            vector<uint32_t> &doc_map = (*doc_maps)[i];
+            doc_map.assign(segments[i]->DocCount(), INVALID_DOC_ID);
+            for (uint32_t j = 0; j < segments[i]->DocCount(); j++)
+            {
+                if (deletes[i] != nullptr && deletes[i]->Test(j))
+                {
+                    continue;
+                }
+                doc_map[j] = (uint32_t)docs.size();
+                docs.push_back(*segments[i]->GetDoc(j));
+                segments[i]->GetContent(j, &docs.back().content);
+            }
+        }
+
+        // 2. 倒排: 同一个关键字的拉链按段的顺序拼接, doc_id换成新段中的doc_id, 仍然是升序的
+        bool positions = true;
+        for (auto segment : segments)
+        {
+            positions = positions && segment->HasPositions();
+        }
+        TermMap postings;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            const vector<uint32_t> &doc_map = (*doc_maps)[i];
+            for (uint32_t term_id = 0; term_id < segments[i]->TermCount(); term_id++)
+            {
+                InvertedList *inverted_list = nullptr;
+                PostingIterator iter;
+                segments[i]->GetInvertedList(term_id, &iter);
+                for (; iter.Valid(); iter.Next())
+                {
+                    uint32_t doc_id = doc_map[iter.DocId()];
+                    if (doc_id == INVALID_DOC_ID)
+                    {
+                        continue;
+                    }
+                    if (nullptr == inverted_list)
+                    {
+                        inverted_list = &postings[segments[i]->GetTerm(term_id)];
+                    }
+                    InvertedElem item;
+                    item.doc_id = doc_id;
+                    item.weight = iter.Weight();
+                    if (positions)
+                    {
+                        PositionCodec::Decode(iter.Positions(), &item.positions);
+                    }
+                    inverted_list->push_back(move(item));
+                }
+            }
+        }
+
+        shared_ptr<Segment> segment = make_shared<Segment>();
+        segment->Init(move(docs), move(postings), positions);
+        return segment;
+    }
+
+    uint32_t DocCount() const { return (uint32_t)forward_index.size(); }
+    uint32_t TermCount() const { return (uint32_t)terms.size(); }
+    bool HasPositions() const { return position_data != nullptr; }
+    uint64_t TitleTokens() const { return title_tokens; }
+    uint64_t ContentTokens() const { return content_tokens; }
+
+    // 拉链, 位置和压缩的正文一共占的字节数
+    uint64_t DataSize() const
+    {
+        return PostingPoolSize() + PositionPoolSize() + doc_store.DataSize();
+    }
+
+    // 包含关键字的文档数(包括被删除的)
+    uint32_t DocFreq(const string &word) const
+    {
+        uint32_t term_id = GetTermId(word);
+        return term_id == INVALID_TERM_ID ? 0 : inverted_index[term_id].doc_count;
+    }
+
+    uint32_t DocFreq(uint32_t term_id) const
+    {
+        return term_id < inverted_index.size() ? inverted_index[term_id].doc_count : 0;
+    }
+
+    // 根据doc_id找到找到文档内容(获得正排), 返回的DocInfo中没有正文, 正文要用GetContent获取
+    const DocInfo *GetDoc(uint32_t doc_id) const
+    {
+        if (doc_id >= forward_index.size())
+        {
+            cerr << "doc_id out range error!" <<endl;
+            return nullptr;
+        }
+        return &forward_index[doc_id];
+    }
+
+    // 解压出文档的正文
+    bool GetContent(uint32_t doc_id, string *content) const
+    {
+        return doc_store.GetContent(doc_id, content);
+    }
+
+    // 根据url找到文档的doc_id, 没有时返回INVALID_DOC_ID
+    uint32_t FindDoc(const string &url) const
+    {
+        auto iter = url_ids.find(url);
+        return iter == url_ids.end() ? INVALID_DOC_ID : iter->second;
+    }
+
+    // 根据关键字string, 获得term_id, 没有这个关键字时返回INVALID_TERM_ID
+    uint32_t GetTermId(const string &word) const
+    {
+        auto iter = term_ids.find(word);
+        if (iter == term_ids.end())
+        {
+            return INVALID_TERM_ID;
+        }
+        return iter->second;
+    }
+
+    // 根据term_id获得关键字, 只在生成摘要这种需要原文的地方使用
+    const string &GetTerm(uint32_t term_id) const
+    {
+        return terms[term_id];
+    }
+
+    // 关键字在这个段中的weight上界
+    int GetMaxWeight(uint32_t term_id) const
+    {
+        return term_id < inverted_index.size() ? (int)inverted_index[term_id].max_weight : 0;
+    }
+
+    // 根据term_id, 获得倒排拉链的迭代器, 没有这个关键字时返回false
+    // 段保存了位置时, 迭代器同时遍历每个结点的位置
+    bool GetInvertedList(uint32_t term_id, PostingIterator *iter) const
+    {
+        if (term_id >= inverted_index.size())
+        {
+            return false;
+        }
+        const PostingListInfo &info = inverted_index[term_id];
+        *iter = PostingIterator(posting_data + info.offset, info.doc_count,
+                                position_data ? position_data + info.position_offset : nullptr);
+        return true;
+    }
+
+    // 把段写成二进制索引文件, 之后启动时用Load直接加载, 不需要再重新分词
+    // data/index/index.bin
+    bool Save(const string &output) const
+    {
+        if (forward_index.size() > UINT32_MAX)
+        {
+            cerr << "too many docs for index file!" << endl;
+            return false;
+        }
+
+        // 1. 正排: title/url都放进字符串区, 文档表中只保存偏移量; 正文块原样写入正文区
+        string strings;
+        vector<IndexFileDoc> docs(forward_index.size());
+        for (size_t i = 0; i < forward_index.size(); i++)
+        {
+            docs[i].title = AppendString(&strings, forward_index[i].title);
+            docs[i].url = AppendString(&strings, forward_index[i].url);
+            docs[i].content = doc_store.Docs()[i];
+            docs[i].title_len = forward_index[i].title_len;
+            docs[i].content_len = forward_index[i].content_len;
+        }
+        const vector<ContentBlock> &blocks = doc_store.Blocks();
+
+        // 2. 倒排: 关键字排序之后再写, 保证同样的输入总是得到同样的文件
+        vector<uint32_t> sorted_ids(terms.size());
+        for (uint32_t i = 0; i < sorted_ids.size(); i++)
+        {
+            sorted_ids[i] = i;
+        }
+        sort(sorted_ids.begin(), sorted_ids.end(), [this](uint32_t id1, uint32_t id2){
+            return terms[id1] < terms[id2];
+            });
+
+        // 压缩拉链是首尾相连的, 下一条拉链的开头就是这一条的结尾, 位置区也一样
+        vector<uint64_t> list_offsets;
+        vector<uint64_t> position_offsets;
+        list_offsets.reserve(inverted_index.size() + 1);
+        position_offsets.reserve(inverted_index.size() + 1);
+        for (auto &info : inverted_index)
+        {
+            list_offsets.push_back(info.offset);
+            position_offsets.push_back(info.position_offset);
+        }
+        list_offsets.push_back(PostingPoolSize());
+        position_offsets.push_back(PositionPoolSize());
+        sort(list_offsets.begin(), list_offsets.end());
+        sort(position_offsets.begin(), position_offsets.end());
+
+        vector<IndexFileTerm> file_terms(sorted_ids.size());
+        string postings;
+        string positions;
+        for (size_t i = 0; i < sorted_ids.size(); i++)
+        {
+            const PostingListInfo &info = inverted_index[sorted_ids[i]];
+            uint64_t end = *upper_bound(list_offsets.begin(), list_offsets.end(), info.offset);
+            file_terms[i].word = AppendString(&strings, terms[sorted_ids[i]]);
+            file_terms[i].posting_offset = postings.size();
+            file_terms[i].position_offset = positions.size();
+            file_terms[i].doc_count = info.doc_count;
+            file_terms[i].max_weight = info.max_weight;
+            postings.append(posting_data + info.offset, end - info.offset);
+            if (HasPositions())
+            {
+                end = *upper_bound(position_offsets.begin(), position_offsets.end(), info.position_offset);
+                positions.append(position_data + info.position_offset, end - info.position_offset);
+            }
+        }
+        postings.append(POSTING_PADDING, '\0');
+
+        // 3. 填写header, 计算各区的偏移量
+        IndexFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+        header.version = INDEX_FILE_VERSION;
+        header.flags = HasPositions() ? INDEX_FLAG_POSITIONS : 0;
+        header.doc_count = docs.size();
+        header.term_count = file_terms.size();
+        header.posting_size = postings.size();
+        header.position_size = positions.size();
+        header.block_count = blocks.size();
+        header.content_size = doc_store.DataSize();
+        header.doc_offset = sizeof(IndexFileHeader);
+        header.block_offset = header.doc_offset + docs.size() * sizeof(IndexFileDoc);
+        header.term_offset = header.block_offset + blocks.size() * sizeof(ContentBlock);
+        header.posting_offset = header.term_offset + file_terms.size() * sizeof(IndexFileTerm);
+        header.position_offset = header.posting_offset + postings.size();
+        header.content_offset = header.position_offset + positions.size();
+        header.string_offset = header.content_offset + header.content_size;
+        header.file_size = header.string_offset + strings.size();
+
+        // 4. 先写临时文件再rename, 正在运行的进程不会读到写了一半的索引
+        string tmp = output + ".tmp";
+        ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            cerr << "open " << tmp << " failed!" << endl;
+            return false;
+        }
+        out.write((const char *)&header, sizeof(header));
+        out.write((const char *)docs.data(), docs.size() * sizeof(IndexFileDoc));
+        out.write((const char *)blocks.data(), blocks.size() * sizeof(ContentBlock));
+        out.write((const char *)file_terms.data(), file_terms.size() * sizeof(IndexFileTerm));
+        out.write(postings.data(), postings.size());
+        out.write(positions.data(), positions.size());
+        out.write(doc_store.Data(), header.content_size);
+        out.write(strings.data(), strings.size());
+        out.close();
+        if (!out || rename(tmp.c_str(), output.c_str()) != 0)
+        {
+            cerr << "write " << output << " failed!" << endl;
+            return false;
+        }
+        logMsg(NORMAL, "索引文件写入成功: %s, 文档数: %lu, 关键字数: %lu", output.c_str(),
+               (unsigned long)header.doc_count, (unsigned long)header.term_count);
+        return true;
+    }
+
+    // mmap方式加载Save写出的索引文件, 文件不存在/版本不对/损坏时返回false
+    // 倒排拉链不解压, 直接在映射的内存上遍历
+    bool Load(const string &input)
+    {
+        MmapFile file;
+        if (!file.Open(input))
+        {
+            return false;
+        }
+        const char *base = file.Data();
+        size_t size = file.Size();
+
+        // 1. 检查header
+        if (size < sizeof(IndexFileHeader))
+        {
+            cerr << input << " is not an index file!" << endl;
+            return false;
+        }
+        const IndexFileHeader *header = (const IndexFileHeader *)base;
+        if (memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0)
+        {
+            cerr << input << " is not an index file!" << endl;
+            return false;
+        }
+        if (header->version != INDEX_FILE_VERSION)
+        {
+            cerr << input << " version " << header->version << " not supported, need " << INDEX_FILE_VERSION << endl;
+            return false;
+        }
+        if (header->file_size != size
+            || !SectionInRange(header->doc_offset, header->doc_count, sizeof(IndexFileDoc), header->block_offset)
+            || !SectionInRange(header->block_offset, header->block_count, sizeof(ContentBlock), header->term_offset)
+            || !SectionInRange(header->term_offset, header->term_count, sizeof(IndexFileTerm), header->posting_offset)
+            || !SectionInRange(header->posting_offset, header->posting_size, 1, header->position_offset)
+            || !SectionInRange(header->position_offset, header->position_size, 1, header->content_offset)
+            || !SectionInRange(header->content_offset, header->content_size, 1, header->string_offset)
+            || header->posting_size < POSTING_PADDING
+            || header->doc_count > UINT32_MAX
+            || header->string_offset > size)
+        {
+            cerr << input << " is truncated or corrupted!" << endl;
+            return false;
+        }
+
+        const IndexFileDoc *docs = (const IndexFileDoc *)(base + header->doc_offset);
+        const ContentBlock *blocks = (const ContentBlock *)(base + header->block_offset);
+        const IndexFileTerm *file_terms = (const IndexFileTerm *)(base + header->term_offset);
+        const char *postings = base + header->posting_offset;
+        const char *strings = base + header->string_offset;
+        uint64_t strings_size = size - header->string_offset;
+
+        // 2. 正排: 正文不读进内存
+        vector<DocInfo> new_forward_index(header->doc_count);
+        vector<DocContent> contents(header->doc_count);
+        unordered_map<string, uint32_t> new_url_ids;
+        new_url_ids.reserve(header->doc_count);
+        uint64_t new_title_tokens = 0, new_content_tokens = 0;
+        for (uint64_t i = 0; i < header->doc_count; i++)
+        {
+            if (!StringInRange(docs[i].title, strings_size)
+                || !StringInRange(docs[i].url, strings_size))
+            {
+                cerr << input << " is truncated or corrupted!" << endl;
+                return false;
+            }
+            DocInfo &doc = new_forward_index[i];
+            doc.title.assign(strings + docs[i].title.offset, docs[i].title.length);
+            doc.url.assign(strings + docs[i].url.offset, docs[i].url.length);
+            doc.title_json = JsonWriter::Quote(doc.title);
+            doc.url_json = JsonWriter::Quote(doc.url);
+            contents[i] = docs[i].content;
+            doc.doc_id = i;
+            doc.title_len = docs[i].title_len;
+            doc.content_len = docs[i].content_len;
+            new_title_tokens += doc.title_len;
+            new_content_tokens += doc.content_len;
+            new_url_ids[doc.url] = (uint32_t)i;
+        }
+
+        if (!DocStore::Check(contents.data(), contents.size(), blocks, header->block_count, header->content_size))
+        {
+            cerr << input << " is truncated or corrupted!" << endl;
+            return false;
+        }
+
+        // 3. 倒排: 词表中的下标就是term_id, 只记录每条拉链的位置
+        unordered_map<string, uint32_t> new_term_ids;
+        vector<string> new_terms(header->term_count);
+        vector<PostingListInfo> new_inverted_index(header->term_count);
+        new_term_ids.reserve(header->term_count);
+        for (uint64_t i = 0; i < header->term_count; i++)
+        {
+            const IndexFileTerm &term = file_terms[i];
+            // 拉链本身不在这里校验, 否则加载时就要把整个倒排区解码一遍
+            if (!StringInRange(term.word, strings_size)
+                || term.posting_offset >= header->posting_size
+                || term.position_offset > header->position_size
+                || term.doc_count > header->doc_count)
+            {
+                cerr << input << " is truncated or corrupted!" << endl;
+                return false;
+            }
+            new_terms[i].assign(strings + term.word.offset, term.word.length);
+            new_term_ids[new_terms[i]] = (uint32_t)i;
+            new_inverted_index[i].offset = term.posting_offset;
+            new_inverted_index[i].position_offset = term.position_offset;
+            new_inverted_index[i].doc_count = (uint32_t)term.doc_count;
+            new_inverted_index[i].max_weight = term.max_weight;
+        }
+
+        forward_index.swap(new_forward_index);
+        doc_store.Attach(contents.data(), contents.size(), blocks, header->block_count, base + header->content_offset);
+        url_ids.swap(new_url_ids);
+        title_tokens = new_title_tokens;
+        content_tokens = new_content_tokens;
+        term_ids.swap(new_term_ids);
+        terms.swap(new_terms);
+        inverted_index.swap(new_inverted_index);
+        string().swap(posting_pool);
+        posting_data = postings;
+        string().swap(position_pool);
+        position_data = (header->flags & INDEX_FLAG_POSITIONS) ? base + header->position_offset : nullptr;
+        index_map.Swap(file);
+        logMsg(NORMAL, "索引文件加载成功: %s, 文档数: %lu, 关键字数: %lu", input.c_str(),
+               (unsigned long)header->doc_count, (unsigned long)header->term_count);
+        return true;
+    }
+
+private:
+    // 把str追加到字符串区, 返回它在字符串区中的位置
+    static IndexFileString AppendString(string *strings, const string &str)
+    {
+        IndexFileString ret;
+        ret.offset = strings->size();
+        ret.length = str.size();
+        strings->append(str);
+        return ret;
+    }
+
+    // [offset, offset + count * elem_size) 不能越过下一个区的开头limit
+    static bool SectionInRange(uint64_t offset, uint64_t count, uint64_t elem_size, uint64_t limit)
+    {
+        return offset <= limit && count <= (limit - offset) / elem_size;
+    }
+
+    static bool StringInRange(const IndexFileString &str, uint64_t strings_size)
+    {
+        return str.offset <= strings_size && str.length <= strings_size - str.offset;
+    }
+
+    // 倒排区中拉链数据的大小(不含末尾的POSTING_PADDING)
+    uint64_t PostingPoolSize() const
+    {
+        if (index_map.Data() != nullptr)
+        {
+            const IndexFileHeader *header = (const IndexFileHeader *)index_map.Data();
+            return header->posting_size - POSTING_PADDING;
+        }
+        return posting_pool.empty() ? 0 : posting_pool.size() - POSTING_PADDING;
+    }
+
+    // 位置区的大小
+    uint64_t PositionPoolSize() const
+    {
+        if (index_map.Data() != nullptr)
+        {
+            return ((const IndexFileHeader *)index_map.Data())->position_size;
+        }
+        return position_pool.size();
+    }
+};
+
+// 在内存中积累文档, 对它们分词建立拉链, 最后生成一个段
+// 既用来一次性建立整个索引, 也用来维护不断有新文档加入的内存段
+// 每批文档加入时用BM25F算好impact, 全集的统计信息是base段(没有时为空)加上builder中已有的文档
+class SegmentBuilder
+{
+private:
+    vector<DocInfo> docs;  // doc_id就是下标
+    TermMap postings;      // 还没有压缩的拉链
+    bool positions;        // 是否记录关键字在正文中的位置
+    Bm25Params bm25;
+    shared_ptr<const Segment> base;
+    uint64_t title_tokens;   // docs中标题的词数之和
+    uint64_t content_tokens; // docs中正文的词数之和
+    size_t scored_docs;      // 前scored_docs个文档的结点已经算好了impact, 后面的是AppendDoc加入的
+
+public:
+    explicit SegmentBuilder(bool positions = true, const Bm25Params &bm25 = Bm25Params(),
+                            shared_ptr<const Segment> base = nullptr)
+        : positions(positions), bm25(bm25), base(base), title_tokens(0), content_tokens(0), scored_docs(0)
+    {}
+
+    uint32_t DocCount() const { return (uint32_t)docs.size(); }
+
+    // 根据url找到已经加入的文档, 没有时返回INVALID_DOC_ID
+    uint32_t FindDoc(const string &url) const
+    {
+        for (size_t i = docs.size(); i-- > 0; )
+        {
+            if (docs[i].url == url)
+            {
+                return (uint32_t)i;
+            }
+        }
+        return INVALID_DOC_ID;
+    }
+
+    // 加入一批文档并对它们分词
+    // thread_num: 并行分词的线程数, 0表示CPU核数; 不管几个线程, 建出来的拉链都一样
+    void AddDocs(vector<DocInfo> new_docs, int thread_num = 0)
+    {
+        if (thread_num <= 0)
+        {
+            thread_num = max(1u, thread::hardware_concurrency());
+        }
+        ScoreAppended();
+
+        size_t first_doc = docs.size();
+        for (auto &doc : new_docs)
+        {
+            doc.doc_id = docs.size();
+            docs.push_back(move(doc));
+        }
+
+        // 1. 按文档大小把新文档切成thread_num段, 每个线程对自己那一段分词, 得到线程私有的拉链
+        // 线程私有的拉链按关键字的hash再分成thread_num份, 下一步每个线程合并其中一份
+        vector<size_t> bounds = SplitDocs(first_doc, thread_num);
+        vector<vector<TermMap>> partial(thread_num, vector<TermMap>(thread_num));
+        atomic<uint64_t> count(0);
+        auto start = chrono::steady_clock::now();
+        RunThreads(thread_num, [&](int t){
+            for (size_t i = bounds[t]; i < bounds[t + 1]; i++)
+            {
+                BuildInvertedIndex(&docs[i], positions, &partial[t]);
+
+                uint64_t n = ++count;
+                if (0 == n % 500)
+                {
+                    logMsg(NORMAL, "当前已经建立的索引文档: %lu, %.0f docs/s", (unsigned long)n, DocsPerSec(n, start));
+                }
+            }
+        });
+
+        for (size_t i = first_doc; i < docs.size(); i++)
+        {
+            title_tokens += docs[i].title_len;
+            content_tokens += docs[i].content_len;
+        }
+
+        // 2. 并行合并: 第b个线程负责第b份关键字, 按线程顺序拼接拉链
+        // 每个线程分到的文档是连续的, 所以拼接之后doc_id仍然是升序的
+        // 合并完的拉链就知道了这批文档中的df, 顺便算出每个结点的impact
+        Bm25Scorer scorer(bm25, docs.size() + (base ? base->DocCount() : 0),
+                          title_tokens + (base ? base->TitleTokens() : 0),
+                          content_tokens + (base ? base->ContentTokens() : 0));
+        vector<TermMap> merged(thread_num);
+        RunThreads(thread_num, [&](int b){
+            for (int t = 0; t < thread_num; t++)
+            {
+                for (auto &pair : partial[t][b])
+                {
+                    AppendList(&merged[b][pair.first], &pair.second);
+                }
+                TermMap().swap(partial[t][b]);
+            }
+            for (auto &pair : merged[b])
+            {
+                Score(scorer, pair.first, &pair.second);
+            }
+        });
+
+        // 3. 接到已有的拉链后面
+        for (auto &part : merged)
+        {
+            for (auto &pair : part)
+            {
+                AppendList(&postings[pair.first], &pair.second);
+            }
+            TermMap().swap(part);
+        }
+        scored_docs = docs.size();
+        if (count > 0)
+        {
+            logMsg(NORMAL, "建立索引完成, 文档数: %lu, 线程数: %d, %.0f docs/s", (unsigned long)count.load(),
+                   thread_num, DocsPerSec(count, start));
+        }
+    }
+
+    // 对一个文档分词, 得到它在每个关键字的拉链中的结点(doc_id还没有分配), 同时记下标题和正文的词数
+    // 不修改builder, 多个线程可以同时调用; 结果按文档顺序交给AppendDoc
+    void Tokenize(DocInfo *doc, TermMap *terms) const
+    {
+        vector<TermMap> parts(1);
+        BuildInvertedIndex(doc, positions, &parts);
+        terms->swap(parts[0]);
+    }
+
+    // 加入一个已经分好词的文档, 它的结点接到拉链后面
+    // 这时还不知道df, 结点的impact要等ScoreAppended再算(Finish会自动调用, Build之前要先调用)
+    void AppendDoc(DocInfo doc, TermMap *terms)
+    {
+        doc.doc_id = docs.size();
+        title_tokens += doc.title_len;
+        content_tokens += doc.content_len;
+        for (auto &pair : *terms)
+        {
+            InvertedList &list = postings[pair.first];
+            for (auto &elem : pair.second)
+            {
+                elem.doc_id = doc.doc_id;
+                list.push_back(move(elem));
+            }
+        }
+        docs.push_back(move(doc));
+    }
+
+    // 算出AppendDoc加入的文档的impact, df和平均长度按现在的全部文档计算
+    // 和用AddDocs一次加入这些文档得到的impact相同
+    void ScoreAppended()
+    {
+        if (scored_docs == docs.size())
+        {
+            return;
+        }
+        Bm25Scorer scorer(bm25, docs.size() + (base ? base->DocCount() : 0),
+                          title_tokens + (base ? base->TitleTokens() : 0),
+                          content_tokens + (base ? base->ContentTokens() : 0));
+        for (auto &pair : postings)
+        {
+            InvertedList &list = pair.second;
+            // 拉链按doc_id升序, 新加入的结点都在最后
+            if (list.empty() || list.back().doc_id < scored_docs)
+            {
+                continue;
+            }
+            double idf = scorer.Idf(list.size() + (base ? base->DocFreq(pair.first) : 0));
+            for (size_t i = list.size(); i-- > 0 && list[i].doc_id >= scored_docs; )
+            {
+                InvertedElem &elem = list[i];
+                const DocInfo &doc = docs[elem.doc_id];
+                elem.weight = (int)scorer.Impact(idf, elem.title_cnt, elem.content_cnt, doc.title_len, doc.content_len);
+            }
+        }
+        scored_docs = docs.size();
+    }
+
+    // 用当前的文档生成一个段, builder本身不变, 之后还可以继续加入文档
+    shared_ptr<Segment> Build() const
+    {
+        shared_ptr<Segment> segment = make_shared<Segment>();
+        segment->Init(docs, postings, positions);
+        return segment;
+    }
+
+    // 用当前的文档生成一个段, 同时清空builder
+    shared_ptr<Segment> Finish()
+    {
+        ScoreAppended();
+        shared_ptr<Segment> segment = make_shared<Segment>();
+        segment->Init(move(docs), move(postings), positions);
+        docs.clear();
+        postings.clear();
+        scored_docs = 0;
+        return segment;
+    }
+
+private:
+    // 算出新加入的一批结点的impact, 这时postings还没有被修改, 可以多个线程同时调用
+    void Score(const Bm25Scorer &scorer, const string &word, InvertedList *list) const
+    {
+        uint64_t df = list->size() + (base ? base->DocFreq(word) : 0);
+        auto iter = postings.find(word);
+        if (iter != postings.end())
+        {
+            df += iter->second.size();
+        }
+        double idf = scorer.Idf(df);
+        for (auto &elem : *list)
+        {
+            const DocInfo &doc = docs[elem.doc_id];
+            elem.weight = (int)scorer.Impact(idf, elem.title_cnt, elem.content_cnt, doc.title_len, doc.content_len);
+        }
+    }
+
+    static void AppendList(InvertedList *dst, InvertedList *src)
+    {
+        if (dst->empty())
+        {
+            dst->swap(*src);
+        }
+        else
+        {
+            dst->insert(dst->end(), src->begin(), src->end());
+        }
+    }
+
+    // 把[first_doc, docs.size())按内容大小尽量均匀地分成n段, 第t段是[bounds[t], bounds[t + 1])
+    vector<size_t> SplitDocs(size_t first_doc, int n)
+    {
+        uint64_t total = 0;
+        for (size_t i = first_doc; i < docs.size(); i++)
+        {
+            total += docs[i].title.size() + docs[i].content.size();
+        }
+
+        vector<size_t> bounds(1, first_doc);
+        uint64_t acc = 0;
+        for (size_t i = first_doc; i < docs.size() && (int)bounds.size() < n; i++)
+        {
+            acc += docs[i].title.size() + docs[i].content.size();
+            if (acc * n >= total * bounds.size())
+            {
+                bounds.push_back(i + 1);
+            }
+        }
+        bounds.resize(n + 1, docs.size());
+        return bounds;
+    }
+
+    // 启动n个线程执行func(0) ... func(n - 1), 等它们全部结束; n == 1时直接在当前线程执行
+    static void RunThreads(int n, const function<void(int)> &func)
+    {
+        if (n == 1)
+        {
+            func(0);
+            return;
+        }
+        vector<thread> threads;
+        for (int i = 0; i < n; i++)
+        {
+            threads.emplace_back(func, i);
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    static double DocsPerSec(uint64_t docs, chrono::steady_clock::time_point start)
+    {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return seconds > 0 ? docs / seconds : 0;
+    }
+
+    // 一次构建倒排索引的过程, 结果按关键字的hash放进parts中的某一份, 同时记下doc的标题和正文的词数
+    // 只写doc和parts, 所以多个线程可以同时对不同的文档调用
+    // positions: 是否记录关键字在正文中的位置
+    // 这里只统计词频, impact要等这一批文档都分完词, 知道了df之后再算(Score)
+    static bool BuildInvertedIndex(DocInfo *doc_ptr, bool positions, vector<TermMap> *parts)
+    {
+        DocInfo &doc = *doc_ptr;
+        // 此时DocInfo中包含: {title, content, url, doc_id}
+        // 然后要根据【word】 --> 【倒排拉链】之间建立映射。
+
+        // 词频统计
+        struct word_cnt 
+        {
+            int title_cnt;
+            int content_cnt;
+            vector<uint32_t> positions; // 在正文中的位置
+            // 初始化
+            word_cnt()
+                : title_cnt(0), content_cnt(0)
+            {}
+        };
+        unordered_map<string, word_cnt> word_map; //用来暂存词频的映射表
+
+        // 对标题进行分词
+        vector<string> title_words;
+        JiebaUtil::CutString(doc.title, &title_words);
+        // 调试
+        // if (doc.doc_id == 1007)
+        // {
+        //     for (auto &s : title_words)
+        //     {
+        //         cout << "title: " << s << endl;
+        //     }
+        // }
+
+        // 对文档标题进行词频统计
+        for (string s : title_words)
+        {
+            boost::to_lower(s);     // 需要统一转化成为小写
+            word_map[s].title_cnt++; // 如果存在就获取，如果不存在就新建
+        }
+
+        // 对文档内容进行分词, 同时得到每个词在正文中的字节偏移量
+        vector<cppjieba::Word> content_words;
+        JiebaUtil::CutString(doc.content, &content_words);
+        // 调试
+        // if (doc.doc_id == 1007)
+        // {
+        //     for (auto &s : content_words)
+        //     {
+        //         cout << "content: " << s.word << endl;
+        //     }
+        // }
+
+        // 对内容进行词频统计
+        for (auto &w : content_words)
+        {
+            string s = move(w.word);
+            boost::to_lower(s);   // 需要统一转化成为小写
+            word_cnt &cnt = word_map[s];
+            cnt.content_cnt++;
+            if (positions)
+            {
+                cnt.positions.push_back(w.offset);
+            }
+        }
+
+        doc.title_len = (uint32_t)title_words.size();
+        doc.content_len = (uint32_t)content_words.size();
+
+        // 把统计好的词频设置进倒排拉链中
+        for (auto &word_pair : word_map)
+        {
+            InvertedElem item;
+            item.doc_id = doc.doc_id;
+            item.title_cnt = word_pair.second.title_cnt;
+            item.content_cnt = word_pair.second.content_cnt;
+            item.positions.swap(word_pair.second.positions);
+            sort(item.positions.begin(), item.positions.end()); // CutForSearch先输出长词中的短词, 不一定是升序的
+            TermMap &part = (*parts)[hash<string>()(word_pair.first) % parts->size()];
+            part[word_pair.first].push_back(move(item));
+        }
+
+        return true;
+    }
+};
@@ -3,41 +3,141 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <cstdint>
 #include <fstream>
 #include <mutex>
 #include <unordered_map>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <boost/algorithm/string.hpp>
 #include "cppjieba/Jieba.hpp"
 #include "log.hpp"
+#include "dict_path.hpp"
 
 // 对文件进行解析的工具类
 class FileUtil
 {
 public:
+    // 把整个文件追加到out后面(保留换行)
+    // 先fstat拿到大小, 一次分配好空间, 再直接read进去, 不经过ifstream的缓冲区, 也不逐行拼接
+    // 网页一般只有几十KB, 这种大小的文件read比mmap快(mmap要建立和解除映射, 还有缺页)
     static bool ReadFile(const std::string &file_path, std::string *out)
     {
-        // 打开文件
-        std::ifstream in(file_path, std::ios::in);
-        if (!in.is_open())
+        int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
         {
             std::cerr << "open file " << file_path << " error!" << std::endl;
             return false;
         }
 
-        // 读取文件
-        // 如何理解getline读取到文件结束呢？？getline的返回值是一个&, while(bool), 本质是因为重载了强制类型转化
-        std::string line;
-        while (std::getline(in, line)) 
+        struct stat st;
+        if (fstat(fd, &st) < 0)
         {
-            *out += line;
+            std::cerr << "stat file " << file_path << " error!" << std::endl;
+            close(fd);
+            return false;
         }
 
-        // 关闭文件
-        in.close();
+        size_t old_size = out->size();
+        out->resize(old_size + st.st_size);
+        size_t done = 0;
+        bool failed = false;
+        while (done < (size_t)st.st_size)
+        {
+            ssize_t n = read(fd, &(*out)[old_size + done], st.st_size - done);
+            if (n > 0)
+            {
+                done += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            failed = n < 0;
+            break; // 出错, 或者文件在读的过程中变短了
+        }
+        close(fd);
+        out->resize(old_size + done);
+        if (failed)
+        {
+            std::cerr << "read file " << file_path << " error!" << std::endl;
+            return false;
+        }
         return true;
     }
 };
 
+// 只读方式把整个文件映射进内存, 析构时自动解除映射
+class MmapFile
+{
+private:
+    char *addr;     // 映射的起始地址
+    size_t length;  // 文件大小
+
+    MmapFile(const MmapFile&) = delete;
+    MmapFile& operator=(const MmapFile&) = delete;
+
+public:
+    MmapFile()
+        : addr(nullptr), length(0)
+    {}
+    ~MmapFile() { Close(); }
+
+    bool Open(const std::string &file_path)
+    {
+        Close();
+        int fd = open(file_path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "open file " << file_path << " error!" << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0)
+        {
+            std::cerr << "stat file " << file_path << " error!" << std::endl;
+            close(fd);
+            return false;
+        }
+
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // 映射建立之后fd就可以关闭了
+        if (p == MAP_FAILED)
+        {
+            std::cerr << "mmap file " << file_path << " error!" << std::endl;
+            return false;
+        }
+        addr = static_cast<char *>(p);
+        length = st.st_size;
+        return true;
+    }
+
+    void Close()
+    {
+        if (addr != nullptr)
+        {
+            munmap(addr, length);
+            addr = nullptr;
+            length = 0;
+        }
+    }
+
+    void Swap(MmapFile &other)
+    {
+        std::swap(addr, other.addr);
+        std::swap(length, other.length);
+    }
+
+    const char *Data() const { return addr; }
+    size_t Size() const { return length; }
+};
+
 // 正排索引的字符串切分
 class StringUtil
 {
@@ -48,20 +148,58 @@ public:
         // 采用boost库函数
         boost::split(*out, target, boost::is_any_of(sep), boost::token_compress_on);
     }
-};
 
-// 引入词库路径
-const char* const DICT_PATH = "./dict/jieba.dict.utf8";
-const char* const HMM_PATH = "./dict/hmm_model.utf8";
-const char* const USER_DICT_PATH = "./dict/user.dict.utf8";
-const char* const IDF_PATH = "./dict/idf.utf8";
-const char* const STOP_WORD_PATH = "./dict/stop_words.utf8";    // 这里面存放的就是暂停词
+    // 64位的内容hash(不用于加密), 每次处理8个字节, 用来判断文件内容有没有变化
+    static uint64_t Hash(const char *data, size_t size)
+    {
+        const uint64_t m1 = 0x87c37b91114253d5ULL;
+        const uint64_t m2 = 0x4cf5ad432745937fULL;
+        uint64_t h = 0x9e3779b97f4a7c15ULL ^ (size * m1);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            w *= m1;
+            w = (w << 31) | (w >> 33);
+            h ^= w * m2;
+            h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, data + i, size - i);
+        h ^= tail * m2;
+        // 最后再打散一次(fmix64)
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+};
 
 // 第一版
 class JiebaUtil
 {
 private:
-    static cppjieba::Jieba jieba; // 类内的静态jieba成员
+    static cppjieba::Jieba &jieba; // 类内的静态jieba成员
+
+    // 有最新的词典镜像时直接映射镜像, 否则解析文本词库
+    // jieba和镜像都不释放: 退出时别的线程可能还在分词
+    static cppjieba::Jieba *Create()
+    {
+        cppjieba::DictImage *image = new cppjieba::DictImage(); // jieba直接使用其中的数组
+        if (image->Open(DICT_IMAGE_PATH))
+        {
+            if (!image->Stale(DictSources()))
+            {
+                return new cppjieba::Jieba(*image);
+            }
+            logMsg(WARNING, "文本词库比%s新, 这次解析文本词库, 请重新运行dict_builder", DICT_IMAGE_PATH);
+        }
+        delete image;
+        return new cppjieba::Jieba(DICT_PATH, HMM_PATH, USER_DICT_PATH, IDF_PATH, STOP_WORD_PATH);
+    }
 
 public:
     // 分词
@@ -69,8 +207,14 @@ public:
     {
         jieba.CutForSearch(src, *out);
     }
+
+    // 分词, 同时得到每个词在src中的字节偏移量(Word::offset)
+    static void CutString(const std::string &src, std::vector<cppjieba::Word> *out)
+    {
+        jieba.CutForSearch(src, *out);
+    }
 };
-cppjieba::Jieba JiebaUtil::jieba(DICT_PATH, HMM_PATH, USER_DICT_PATH, IDF_PATH, STOP_WORD_PATH);
+cppjieba::Jieba &JiebaUtil::jieba = *JiebaUtil::Create();
 
 // 为什么用第一版, 而不用第二版呢？
 // 因为move即在boost库中, 又在暂停词中！